@@ -61,16 +61,11 @@ namespace dae
 		}
 
 		/**
-		 * \brief BRDF NormalDistribution >> Trowbridge-Reitz GGX (UE4 implemetation - squared(roughness))
-		 * \param n Surface normal
-		 * \param h Normalized half vector
-		 * \param roughness Roughness of the material
-		 * \return BRDF Normal Distribution Term using Trowbridge-Reitz GGX
+		 * \brief NormalDistribution_GGX with the roughness remap already done, for materials that compute it once
+		 * \param a2 roughness^4
 		 */
-		static float NormalDistribution_GGX(const Vector3& n, const Vector3& h, float roughness)
+		static float NormalDistribution_GGX_Alpha2(const Vector3& n, const Vector3& h, float a2)
 		{
-			float a = roughness * roughness;
-			float a2 = a * a;
 			float NdotH = std::max(Vector3::Dot(n, h), 0.0f);
 			float NdotH2 = NdotH * NdotH;
 
@@ -79,6 +74,19 @@ namespace dae
 			denom = static_cast<float>(M_PI) * denom * denom;
 
 			return nom / denom;
+		}
+
+		/**
+		 * \brief BRDF NormalDistribution >> Trowbridge-Reitz GGX (UE4 implemetation - squared(roughness))
+		 * \param n Surface normal
+		 * \param h Normalized half vector
+		 * \param roughness Roughness of the material
+		 * \return BRDF Normal Distribution Term using Trowbridge-Reitz GGX
+		 */
+		static float NormalDistribution_GGX(const Vector3& n, const Vector3& h, float roughness)
+		{
+			float a = roughness * roughness;
+			return NormalDistribution_GGX_Alpha2(n, h, a * a);
 
 		}
 
@@ -96,6 +104,16 @@ namespace dae
 			return G;
 		}
 
+		/**
+		 * \brief GeometryFunction_Smith with the roughness remap already done, for materials that compute it once
+		 * \param k ((roughness^2 + 1)^2) / 8
+		 */
+		static float GeometryFunction_Smith_K(const Vector3& n, const Vector3& v, const Vector3& l, float k)
+		{
+			float Gsmith = GeometryFunction_SchlickGGX(n, -v, k) * GeometryFunction_SchlickGGX(n, l, k);
+			return Gsmith;
+		}
+
 		/**
 		 * \brief BRDF Geometry Function >> Smith (Direct Lighting)
 		 * \param n Normal of the surface
@@ -110,8 +128,7 @@ namespace dae
 			float a = roughness * roughness;
 			float k = ((a + 1.0f) * (a + 1.0f)) / 8;
 
-			float Gsmith = GeometryFunction_SchlickGGX(n, -v, k) * GeometryFunction_SchlickGGX(n, l, k);
-			return Gsmith;
+			return GeometryFunction_Smith_K(n, v, l, k);
 		}
 
 	}
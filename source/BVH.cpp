@@ -0,0 +1,969 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <future>
+#include <thread>
+
+namespace dae {
+
+	namespace
+	{
+		//The build loops run per primitive per axis, kept inline instead of going through the Vector3 operators
+		float GetAxis(const Vector3& v, int axis)
+		{
+			return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+		}
+
+		void GrowBounds(Vector3& minAABB, Vector3& maxAABB, const Vector3& otherMin, const Vector3& otherMax)
+		{
+			minAABB.x = std::min(minAABB.x, otherMin.x);
+			minAABB.y = std::min(minAABB.y, otherMin.y);
+			minAABB.z = std::min(minAABB.z, otherMin.z);
+			maxAABB.x = std::max(maxAABB.x, otherMax.x);
+			maxAABB.y = std::max(maxAABB.y, otherMax.y);
+			maxAABB.z = std::max(maxAABB.z, otherMax.z);
+		}
+
+		//Splits [0, count) in chunkCount consecutive ranges and runs chunkFunc(chunkIdx, begin, end) on each of them concurrently
+		template<typename ChunkFunc>
+		void RunChunks(uint32_t chunkCount, uint32_t count, ChunkFunc&& chunkFunc)
+		{
+			if (chunkCount <= 1)
+			{
+				chunkFunc(0u, 0u, count);
+				return;
+			}
+
+			std::vector<std::future<void>> chunkTasks{};
+			chunkTasks.reserve(chunkCount);
+
+			const uint32_t chunkSize{ (count + chunkCount - 1) / chunkCount };
+			for (uint32_t chunkIdx{}; chunkIdx < chunkCount; ++chunkIdx)
+			{
+				const uint32_t begin{ std::min(chunkIdx * chunkSize, count) };
+				const uint32_t end{ std::min(begin + chunkSize, count) };
+
+				chunkTasks.emplace_back(std::async(std::launch::async, [&chunkFunc, chunkIdx, begin, end]
+					{
+						chunkFunc(chunkIdx, begin, end);
+					}));
+			}
+
+			for (auto& chunkTask : chunkTasks)
+			{
+				chunkTask.wait();
+			}
+		}
+
+		//Spreads the lower 10 bits of value so there are 2 zero bits between each of them
+		uint32_t ExpandBits(uint32_t value)
+		{
+			value = (value * 0x00010001u) & 0xFF0000FFu;
+			value = (value * 0x00000101u) & 0x0F00F00Fu;
+			value = (value * 0x00000011u) & 0xC30C30C3u;
+			value = (value * 0x00000005u) & 0x49249249u;
+			return value;
+		}
+	}
+
+	void BVHBin::Grow(const Vector3& primitiveMin, const Vector3& primitiveMax)
+	{
+		GrowBounds(minAABB, maxAABB, primitiveMin, primitiveMax);
+		++count;
+	}
+
+	void BVHBin::Grow(const BVHBin& bin)
+	{
+		if (bin.count == 0)
+			return;
+
+		GrowBounds(minAABB, maxAABB, bin.minAABB, bin.maxAABB);
+		count += bin.count;
+	}
+
+	void BVH::Build(const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		const auto start{ std::chrono::high_resolution_clock::now() };
+
+		GatherTriangleBounds(positions, indices);
+		BuildFromScratchData();
+
+		m_Stats.lastUpdateWasRefit = false;
+		m_Stats.lastUpdateMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void BVH::BuildFromBounds(const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax)
+	{
+		const auto start{ std::chrono::high_resolution_clock::now() };
+
+		GatherBounds(primitiveMin, primitiveMax);
+		BuildFromScratchData();
+
+		m_Stats.lastUpdateWasRefit = false;
+		m_Stats.lastUpdateMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void BVH::Refit(const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		if (!CanRefit(indices.size() / 3))
+		{
+			Build(positions, indices);
+			return;
+		}
+
+		const auto start{ std::chrono::high_resolution_clock::now() };
+
+		GatherTriangleBounds(positions, indices);
+		RefitFromScratchData();
+
+		m_Stats.lastUpdateMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void BVH::RefitFromBounds(const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax)
+	{
+		if (!CanRefit(primitiveMin.size()))
+		{
+			BuildFromBounds(primitiveMin, primitiveMax);
+			return;
+		}
+
+		const auto start{ std::chrono::high_resolution_clock::now() };
+
+		GatherBounds(primitiveMin, primitiveMax);
+		RefitFromScratchData();
+
+		m_Stats.lastUpdateMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void BVH::Load(std::vector<BVHNode>&& nodes, std::vector<uint32_t>&& primitiveIndices)
+	{
+		const auto start{ std::chrono::high_resolution_clock::now() };
+
+		Clear();
+		m_Nodes = std::move(nodes);
+		m_PrimitiveIndices = std::move(primitiveIndices);
+
+		UpdateQualityMetrics();
+		UpdateWideNodes();
+		m_Stats.overlapAtBuild = m_Stats.overlap;
+		m_Stats.nodeCount = static_cast<uint32_t>(m_Nodes.size());
+
+		m_Stats.lastUpdateWasRefit = false;
+		m_Stats.lastUpdateMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void BVH::GatherTriangleBounds(const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		const uint32_t triangleCount{ static_cast<uint32_t>(indices.size() / 3) };
+
+		//Precompute per triangle bounds + centroid
+		m_PrimitiveMin.resize(triangleCount);
+		m_PrimitiveMax.resize(triangleCount);
+		m_Centroids.resize(triangleCount);
+
+		for (uint32_t triangleIdx{}; triangleIdx < triangleCount; ++triangleIdx)
+		{
+			const Vector3& v0{ positions[indices[triangleIdx * 3]] };
+			const Vector3& v1{ positions[indices[triangleIdx * 3 + 1]] };
+			const Vector3& v2{ positions[indices[triangleIdx * 3 + 2]] };
+
+			m_PrimitiveMin[triangleIdx] = Vector3::Min(v0, Vector3::Min(v1, v2));
+			m_PrimitiveMax[triangleIdx] = Vector3::Max(v0, Vector3::Max(v1, v2));
+			m_Centroids[triangleIdx] = (v0 + v1 + v2) / 3.f;
+		}
+	}
+
+	void BVH::GatherBounds(const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax)
+	{
+		m_PrimitiveMin = primitiveMin;
+		m_PrimitiveMax = primitiveMax;
+
+		m_Centroids.resize(m_PrimitiveMin.size());
+		for (size_t primitiveIdx{}; primitiveIdx < m_PrimitiveMin.size(); ++primitiveIdx)
+		{
+			m_Centroids[primitiveIdx] = (m_PrimitiveMin[primitiveIdx] + m_PrimitiveMax[primitiveIdx]) * .5f;
+		}
+	}
+
+	bool BVH::CanRefit(size_t primitiveCount) const
+	{
+		//Refitting keeps the topology, so the primitive set has to be the one the tree was built for
+		return m_RefitEnabled && !IsEmpty() && primitiveCount == m_PrimitiveIndices.size();
+	}
+
+	void BVH::BuildFromScratchData()
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(m_Centroids.size()) };
+
+		Clear();
+		if (primitiveCount == 0)
+			return;
+
+		m_PrimitiveIndices.resize(primitiveCount);
+
+		for (uint32_t primitiveIdx{}; primitiveIdx < primitiveCount; ++primitiveIdx)
+		{
+			m_PrimitiveIndices[primitiveIdx] = primitiveIdx;
+		}
+
+		BVHNode root{};
+		root.leftFirst = 0;
+		root.primitiveCount = primitiveCount;
+
+		//A binary tree with N leaves never has more than 2N - 1 nodes
+		const size_t maxNodeCount{ 2 * static_cast<size_t>(primitiveCount) - 1 };
+
+		switch (m_Builder)
+		{
+		case BVHBuilder::SweepSAH:
+		{
+			m_SweepAreas.resize(primitiveCount);
+			m_Nodes.reserve(maxNodeCount);
+			m_Nodes.emplace_back(root);
+
+			UpdateNodeBounds(0);
+			Subdivide(0);
+			break;
+		}
+		case BVHBuilder::BinnedSAH:
+		{
+			//Sized up front: subtrees are built concurrently and grab their nodes through an atomic counter
+			m_Nodes.resize(maxNodeCount);
+			m_Nodes[0] = root;
+
+			UpdateNodeBounds(0);
+
+			Vector3 centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (const Vector3& centroid : m_Centroids)
+			{
+				GrowBounds(centroidMin, centroidMax, centroid, centroid);
+			}
+
+			std::atomic<uint32_t> nodesUsed{ 1 };
+			SubdivideBinned(0, centroidMin, centroidMax, 0, nodesUsed);
+
+			m_Nodes.resize(nodesUsed);
+			break;
+		}
+		case BVHBuilder::LBVH:
+		{
+			m_Nodes.resize(maxNodeCount);
+			m_Nodes[0] = root;
+
+			BuildLBVH();
+			break;
+		}
+		}
+
+		UpdateQualityMetrics();
+		UpdateWideNodes();
+		m_Stats.overlapAtBuild = m_Stats.overlap;
+		m_Stats.nodeCount = static_cast<uint32_t>(m_Nodes.size());
+		++m_Stats.rebuildCount;
+	}
+
+	void BVH::SubdivideBinned(uint32_t nodeIdx, const Vector3& centroidMin, const Vector3& centroidMax, int depth, std::atomic<uint32_t>& nodesUsed)
+	{
+		//m_Nodes never reallocates during a binned build, the reference stays valid
+		BVHNode& node{ m_Nodes[nodeIdx] };
+
+		if (node.primitiveCount <= 1)
+			return;
+
+		std::array<std::array<BVHBin, binCount>, 3> bins{};
+		BinPrimitives(node, centroidMin, centroidMax, bins);
+
+		//Evaluate the SAH cost of the split planes between the bins
+		float bestCost{ FLT_MAX };
+		int bestAxis{ -1 };
+		uint32_t bestSplit{};
+
+		for (int axis{}; axis < 3; ++axis)
+		{
+			if (GetAxis(centroidMax, axis) <= GetAxis(centroidMin, axis))
+				continue;
+
+			//Right to left, storing the area + count of everything right of each split
+			std::array<float, binCount> rightAreas{};
+			std::array<uint32_t, binCount> rightCounts{};
+			BVHBin right{};
+			for (uint32_t binIdx{ binCount - 1 }; binIdx > 0; --binIdx)
+			{
+				right.Grow(bins[axis][binIdx]);
+				rightAreas[binIdx] = right.count > 0 ? SurfaceArea(right.minAABB, right.maxAABB) : 0.f;
+				rightCounts[binIdx] = right.count;
+			}
+
+			BVHBin left{};
+			for (uint32_t split{}; split < binCount - 1; ++split)
+			{
+				left.Grow(bins[axis][split]);
+				if (left.count == 0 || rightCounts[split + 1] == 0)
+					continue;
+
+				const float cost{ left.count * SurfaceArea(left.minAABB, left.maxAABB)
+					+ rightCounts[split + 1] * rightAreas[split + 1] };
+
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		//Stop when visiting two children is more expensive than intersecting all primitives of this node
+		const float nodeArea{ SurfaceArea(node.minAABB, node.maxAABB) };
+		const float leafCost{ node.primitiveCount * nodeArea };
+		if (bestAxis < 0 || traversalCost * nodeArea + bestCost >= leafCost)
+			return;
+
+		//Partition on the bin index, exactly as the primitives were binned
+		const float axisCentroidMin{ GetAxis(centroidMin, bestAxis) };
+		const float binScale{ binCount / (GetAxis(centroidMax, bestAxis) - axisCentroidMin) };
+		const auto first{ m_PrimitiveIndices.begin() + node.leftFirst };
+		const auto middle{ std::partition(first, first + node.primitiveCount, [&](uint32_t primitiveIdx)
+			{
+				return GetBinIndex(GetAxis(m_Centroids[primitiveIdx], bestAxis), axisCentroidMin, binScale) <= bestSplit;
+			}) };
+
+		const uint32_t leftCount{ static_cast<uint32_t>(middle - first) };
+
+		//The children's centroid bounds drive their binning, gathered here rather than carried in every bin
+		Vector3 leftCentroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 leftCentroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (auto it{ first }; it != middle; ++it)
+		{
+			GrowBounds(leftCentroidMin, leftCentroidMax, m_Centroids[*it], m_Centroids[*it]);
+		}
+
+		Vector3 rightCentroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 rightCentroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (auto it{ middle }; it != first + node.primitiveCount; ++it)
+		{
+			GrowBounds(rightCentroidMin, rightCentroidMax, m_Centroids[*it], m_Centroids[*it]);
+		}
+
+		//Children bounds come straight out of the bins
+		BVHBin leftBin{};
+		BVHBin rightBin{};
+		for (uint32_t binIdx{}; binIdx < binCount; ++binIdx)
+		{
+			if (binIdx <= bestSplit)
+				leftBin.Grow(bins[bestAxis][binIdx]);
+			else
+				rightBin.Grow(bins[bestAxis][binIdx]);
+		}
+
+		const uint32_t leftChildIdx{ nodesUsed.fetch_add(2) };
+
+		BVHNode& leftChild{ m_Nodes[leftChildIdx] };
+		leftChild.leftFirst = node.leftFirst;
+		leftChild.primitiveCount = leftCount;
+		leftChild.minAABB = leftBin.minAABB;
+		leftChild.maxAABB = leftBin.maxAABB;
+
+		BVHNode& rightChild{ m_Nodes[leftChildIdx + 1] };
+		rightChild.leftFirst = node.leftFirst + leftCount;
+		rightChild.primitiveCount = node.primitiveCount - leftCount;
+		rightChild.minAABB = rightBin.minAABB;
+		rightChild.maxAABB = rightBin.maxAABB;
+
+		//Keep the count before turning this into an inner node
+		const uint32_t primitiveCount{ node.primitiveCount };
+		node.leftFirst = leftChildIdx;
+		node.primitiveCount = 0;
+
+		//Large subtrees near the top are handed to another thread, the rest is built on this one
+		if (primitiveCount >= minParallelSubtreeSize && depth < maxParallelDepth)
+		{
+			auto leftTask{ std::async(std::launch::async, [&]
+				{
+					SubdivideBinned(leftChildIdx, leftCentroidMin, leftCentroidMax, depth + 1, nodesUsed);
+				}) };
+
+			SubdivideBinned(leftChildIdx + 1, rightCentroidMin, rightCentroidMax, depth + 1, nodesUsed);
+			leftTask.wait();
+			return;
+		}
+
+		SubdivideBinned(leftChildIdx, leftCentroidMin, leftCentroidMax, depth + 1, nodesUsed);
+		SubdivideBinned(leftChildIdx + 1, rightCentroidMin, rightCentroidMax, depth + 1, nodesUsed);
+	}
+
+	void BVH::BinPrimitives(const BVHNode& node, const Vector3& centroidMin, const Vector3& centroidMax, std::array<std::array<BVHBin, binCount>, 3>& bins) const
+	{
+		std::array<float, 3> axisMin{};
+		std::array<float, 3> binScale{};
+		for (int axis{}; axis < 3; ++axis)
+		{
+			axisMin[axis] = GetAxis(centroidMin, axis);
+			const float extent{ GetAxis(centroidMax, axis) - axisMin[axis] };
+			binScale[axis] = extent > 0.f ? binCount / extent : 0.f;
+		}
+
+		const auto binRange = [&](uint32_t begin, uint32_t end, std::array<std::array<BVHBin, binCount>, 3>& rangeBins)
+		{
+			for (uint32_t i{ begin }; i < end; ++i)
+			{
+				const uint32_t primitiveIdx{ m_PrimitiveIndices[node.leftFirst + i] };
+				const Vector3& centroid{ m_Centroids[primitiveIdx] };
+
+				for (int axis{}; axis < 3; ++axis)
+				{
+					BVHBin& bin{ rangeBins[axis][GetBinIndex(GetAxis(centroid, axis), axisMin[axis], binScale[axis])] };
+					bin.Grow(m_PrimitiveMin[primitiveIdx], m_PrimitiveMax[primitiveIdx]);
+				}
+			}
+		};
+
+		//Big nodes (top of the tree, where there are no subtrees to spread yet) bin in parallel chunks
+		const uint32_t chunkCount{ GetChunkCount(node.primitiveCount) };
+		if (chunkCount == 1)
+		{
+			binRange(0, node.primitiveCount, bins);
+			return;
+		}
+
+		std::vector<std::array<std::array<BVHBin, binCount>, 3>> chunkBins(chunkCount);
+		RunChunks(chunkCount, node.primitiveCount, [&](uint32_t chunkIdx, uint32_t begin, uint32_t end)
+			{
+				binRange(begin, end, chunkBins[chunkIdx]);
+			});
+
+		for (uint32_t chunkIdx{}; chunkIdx < chunkCount; ++chunkIdx)
+		{
+			for (int axis{}; axis < 3; ++axis)
+			{
+				for (uint32_t binIdx{}; binIdx < binCount; ++binIdx)
+				{
+					bins[axis][binIdx].Grow(chunkBins[chunkIdx][axis][binIdx]);
+				}
+			}
+		}
+	}
+
+	uint32_t BVH::GetBinIndex(float centroid, float centroidMin, float binScale)
+	{
+		const int binIdx{ static_cast<int>((centroid - centroidMin) * binScale) };
+		return static_cast<uint32_t>(std::clamp(binIdx, 0, static_cast<int>(binCount) - 1));
+	}
+
+	uint32_t BVH::GetChunkCount(uint32_t primitiveCount)
+	{
+		if (primitiveCount < 2 * minParallelBinningSize)
+			return 1;
+
+		return std::max(1u, std::min(std::thread::hardware_concurrency(), primitiveCount / minParallelBinningSize));
+	}
+
+	void BVH::BuildLBVH()
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(m_Centroids.size()) };
+		const uint32_t chunkCount{ GetChunkCount(primitiveCount) };
+
+		Vector3 centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (const Vector3& centroid : m_Centroids)
+		{
+			GrowBounds(centroidMin, centroidMax, centroid, centroid);
+		}
+
+		//Quantize the centroids to a 2^10 grid over the centroid bounds
+		constexpr uint32_t maxCell{ (1u << mortonBitsPerAxis) - 1 };
+		std::array<float, 3> cellScale{};
+		for (int axis{}; axis < 3; ++axis)
+		{
+			const float extent{ GetAxis(centroidMax, axis) - GetAxis(centroidMin, axis) };
+			cellScale[axis] = extent > 0.f ? (maxCell + 1) / extent : 0.f;
+		}
+
+		const auto getCell = [&](float value, float axisMin, int axis)
+		{
+			return std::min(static_cast<uint32_t>((value - axisMin) * cellScale[axis]), maxCell);
+		};
+
+		m_MortonCodes.resize(primitiveCount);
+		RunChunks(chunkCount, primitiveCount, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t primitiveIdx{ begin }; primitiveIdx < end; ++primitiveIdx)
+				{
+					const Vector3& centroid{ m_Centroids[primitiveIdx] };
+					m_MortonCodes[primitiveIdx] = GetMortonCode(getCell(centroid.x, centroidMin.x, 0),
+						getCell(centroid.y, centroidMin.y, 1), getCell(centroid.z, centroidMin.z, 2));
+				}
+			});
+
+		SortMortonCodes();
+
+		std::atomic<uint32_t> nodesUsed{ 1 };
+		SubdivideLBVH(0, 0, nodesUsed);
+		m_Nodes.resize(nodesUsed);
+
+		//The topology only depends on the codes, bounds are filled in afterwards
+		UpdateBoundsBottomUp();
+	}
+
+	void BVH::SortMortonCodes()
+	{
+		//Least significant digit radix sort, sorts m_PrimitiveIndices along with the codes
+		constexpr uint32_t bucketCount{ 1u << radixBits };
+
+		const uint32_t primitiveCount{ static_cast<uint32_t>(m_MortonCodes.size()) };
+		const uint32_t chunkCount{ GetChunkCount(primitiveCount) };
+
+		m_SortScratchCodes.resize(primitiveCount);
+		m_SortScratchIndices.resize(primitiveCount);
+
+		std::vector<std::array<uint32_t, bucketCount>> chunkOffsets(chunkCount);
+
+		for (uint32_t shift{}; shift < 3 * mortonBitsPerAxis; shift += radixBits)
+		{
+			RunChunks(chunkCount, primitiveCount, [&](uint32_t chunkIdx, uint32_t begin, uint32_t end)
+				{
+					auto& histogram{ chunkOffsets[chunkIdx] };
+					histogram.fill(0);
+
+					for (uint32_t i{ begin }; i < end; ++i)
+					{
+						++histogram[(m_MortonCodes[i] >> shift) & (bucketCount - 1)];
+					}
+				});
+
+			//Digit major, then chunk order: every chunk writes behind the previous ones, which keeps the sort stable
+			uint32_t offset{};
+			for (uint32_t digit{}; digit < bucketCount; ++digit)
+			{
+				for (auto& offsets : chunkOffsets)
+				{
+					const uint32_t digitCount{ offsets[digit] };
+					offsets[digit] = offset;
+					offset += digitCount;
+				}
+			}
+
+			RunChunks(chunkCount, primitiveCount, [&](uint32_t chunkIdx, uint32_t begin, uint32_t end)
+				{
+					auto& offsets{ chunkOffsets[chunkIdx] };
+
+					for (uint32_t i{ begin }; i < end; ++i)
+					{
+						const uint32_t destination{ offsets[(m_MortonCodes[i] >> shift) & (bucketCount - 1)]++ };
+						m_SortScratchCodes[destination] = m_MortonCodes[i];
+						m_SortScratchIndices[destination] = m_PrimitiveIndices[i];
+					}
+				});
+
+			m_MortonCodes.swap(m_SortScratchCodes);
+			m_PrimitiveIndices.swap(m_SortScratchIndices);
+		}
+	}
+
+	void BVH::SubdivideLBVH(uint32_t nodeIdx, int depth, std::atomic<uint32_t>& nodesUsed)
+	{
+		BVHNode& node{ m_Nodes[nodeIdx] };
+
+		if (node.primitiveCount <= maxLBVHLeafSize)
+			return;
+
+		const uint32_t first{ node.leftFirst };
+		const uint32_t last{ node.leftFirst + node.primitiveCount - 1 };
+		const uint32_t firstCode{ m_MortonCodes[first] };
+		const uint32_t lastCode{ m_MortonCodes[last] };
+
+		//Split where the highest differing bit of the range flips, identical codes are simply halved
+		uint32_t leftCount{ node.primitiveCount / 2 };
+		if (firstCode != lastCode)
+		{
+			const int commonPrefix{ std::countl_zero(firstCode ^ lastCode) };
+
+			//Binary search for the last code that still shares more than the common prefix with the first one
+			uint32_t split{ first };
+			uint32_t step{ node.primitiveCount - 1 };
+			do
+			{
+				step = (step + 1) / 2;
+				const uint32_t newSplit{ split + step };
+
+				if (newSplit < last && std::countl_zero(firstCode ^ m_MortonCodes[newSplit]) > commonPrefix)
+					split = newSplit;
+			} while (step > 1);
+
+			leftCount = split - first + 1;
+		}
+
+		const uint32_t leftChildIdx{ nodesUsed.fetch_add(2) };
+
+		BVHNode& leftChild{ m_Nodes[leftChildIdx] };
+		leftChild.leftFirst = first;
+		leftChild.primitiveCount = leftCount;
+
+		BVHNode& rightChild{ m_Nodes[leftChildIdx + 1] };
+		rightChild.leftFirst = first + leftCount;
+		rightChild.primitiveCount = node.primitiveCount - leftCount;
+
+		const uint32_t primitiveCount{ node.primitiveCount };
+		node.leftFirst = leftChildIdx;
+		node.primitiveCount = 0;
+
+		if (primitiveCount >= minParallelSubtreeSize && depth < maxParallelDepth)
+		{
+			auto leftTask{ std::async(std::launch::async, [&]
+				{
+					SubdivideLBVH(leftChildIdx, depth + 1, nodesUsed);
+				}) };
+
+			SubdivideLBVH(leftChildIdx + 1, depth + 1, nodesUsed);
+			leftTask.wait();
+			return;
+		}
+
+		SubdivideLBVH(leftChildIdx, depth + 1, nodesUsed);
+		SubdivideLBVH(leftChildIdx + 1, depth + 1, nodesUsed);
+	}
+
+	uint32_t BVH::GetMortonCode(uint32_t x, uint32_t y, uint32_t z)
+	{
+		return (ExpandBits(x) << 2) | (ExpandBits(y) << 1) | ExpandBits(z);
+	}
+
+	void BVH::RefitFromScratchData()
+	{
+		UpdateBoundsBottomUp();
+		UpdateQualityMetrics();
+
+		//Moving primitives make sibling boxes grow into each other, past the threshold a new tree is cheaper to trace
+		if (m_Stats.overlap - m_Stats.overlapAtBuild > m_RefitThreshold)
+		{
+			BuildFromScratchData();
+			m_Stats.lastUpdateWasRefit = false;
+			return;
+		}
+
+		UpdateWideNodes();
+		m_Stats.lastUpdateWasRefit = true;
+		++m_Stats.refitCount;
+	}
+
+	void BVH::SetWideNodesEnabled(bool enabled)
+	{
+		if (enabled == m_WideNodesEnabled)
+			return;
+
+		m_WideNodesEnabled = enabled;
+		UpdateWideNodes();
+	}
+
+	void BVH::UpdateWideNodes()
+	{
+		//Collapsing is a linear pass, simply redone after a refit instead of patching the bounds in place
+		m_WideNodes.clear();
+
+		if (m_WideNodesEnabled && !m_Nodes.empty())
+		{
+			m_WideNodes.reserve(m_Nodes.size() / 3 + 1);
+
+			if (m_Nodes[0].IsLeaf())
+			{
+				m_WideNodes.emplace_back();
+				SetWideChild(0, 0, 0);
+			}
+			else
+			{
+				CollapseNode(0);
+			}
+		}
+
+		m_Stats.wideNodeCount = static_cast<uint32_t>(m_WideNodes.size());
+	}
+
+	uint32_t BVH::CollapseNode(uint32_t nodeIdx)
+	{
+		const uint32_t wideNodeIdx{ static_cast<uint32_t>(m_WideNodes.size()) };
+		m_WideNodes.emplace_back();
+
+		//Children of nodeIdx, lower one along the split axis first
+		uint32_t sides[2]{ m_Nodes[nodeIdx].leftFirst, m_Nodes[nodeIdx].leftFirst + 1 };
+		const int sideAxis{ GetSplitAxis(sides[0], sides[1]) };
+		if (GetAxis(m_Nodes[sides[1]].minAABB, sideAxis) + GetAxis(m_Nodes[sides[1]].maxAABB, sideAxis)
+			< GetAxis(m_Nodes[sides[0]].minAABB, sideAxis) + GetAxis(m_Nodes[sides[0]].maxAABB, sideAxis))
+			std::swap(sides[0], sides[1]);
+
+		m_WideNodes[wideNodeIdx].splitAxis[0] = static_cast<uint8_t>(sideAxis);
+
+		//Each side contributes its own children (grandchildren of nodeIdx), or itself when it's a leaf
+		uint32_t grandchildren[4]{};
+		bool hasGrandchild[4]{};
+		for (int side{}; side < 2; ++side)
+		{
+			const BVHNode& sideNode{ m_Nodes[sides[side]] };
+			if (sideNode.IsLeaf())
+			{
+				grandchildren[side * 2] = sides[side];
+				hasGrandchild[side * 2] = true;
+				continue;
+			}
+
+			uint32_t low{ sideNode.leftFirst };
+			uint32_t high{ sideNode.leftFirst + 1 };
+			const int axis{ GetSplitAxis(low, high) };
+			if (GetAxis(m_Nodes[high].minAABB, axis) + GetAxis(m_Nodes[high].maxAABB, axis)
+				< GetAxis(m_Nodes[low].minAABB, axis) + GetAxis(m_Nodes[low].maxAABB, axis))
+				std::swap(low, high);
+
+			m_WideNodes[wideNodeIdx].splitAxis[1 + side] = static_cast<uint8_t>(axis);
+			grandchildren[side * 2] = low;
+			grandchildren[side * 2 + 1] = high;
+			hasGrandchild[side * 2] = true;
+			hasGrandchild[side * 2 + 1] = true;
+		}
+
+		for (int slot{}; slot < 4; ++slot)
+		{
+			if (hasGrandchild[slot])
+				SetWideChild(wideNodeIdx, slot, grandchildren[slot]);
+		}
+
+		return wideNodeIdx;
+	}
+
+	void BVH::SetWideChild(uint32_t wideNodeIdx, int slot, uint32_t nodeIdx)
+	{
+		const BVHNode& node{ m_Nodes[nodeIdx] };
+
+		//Recurse first, m_WideNodes may reallocate
+		const uint32_t childFirst{ node.IsLeaf() ? node.leftFirst : CollapseNode(nodeIdx) };
+
+		BVH4Node& wideNode{ m_WideNodes[wideNodeIdx] };
+		wideNode.minX[slot] = node.minAABB.x;
+		wideNode.minY[slot] = node.minAABB.y;
+		wideNode.minZ[slot] = node.minAABB.z;
+		wideNode.maxX[slot] = node.maxAABB.x;
+		wideNode.maxY[slot] = node.maxAABB.y;
+		wideNode.maxZ[slot] = node.maxAABB.z;
+		wideNode.childFirst[slot] = childFirst;
+		wideNode.childCount[slot] = node.primitiveCount;
+		wideNode.childMask |= static_cast<uint8_t>(1 << slot);
+	}
+
+	int BVH::GetSplitAxis(uint32_t leftIdx, uint32_t rightIdx) const
+	{
+		//Binary nodes don't store their split plane, the axis along which the child centers differ most stands in for it
+		const BVHNode& left{ m_Nodes[leftIdx] };
+		const BVHNode& right{ m_Nodes[rightIdx] };
+
+		int splitAxis{};
+		float maxDistance{ -1.f };
+		for (int axis{}; axis < 3; ++axis)
+		{
+			const float distance{ std::abs(GetAxis(right.minAABB, axis) + GetAxis(right.maxAABB, axis)
+				- GetAxis(left.minAABB, axis) - GetAxis(left.maxAABB, axis)) };
+
+			if (distance > maxDistance)
+			{
+				maxDistance = distance;
+				splitAxis = axis;
+			}
+		}
+
+		return splitAxis;
+	}
+
+	void BVH::UpdateBoundsBottomUp()
+	{
+		//Children are always stored after their parent, so a reverse sweep updates them first
+		for (size_t nodeIdx{ m_Nodes.size() }; nodeIdx-- > 0;)
+		{
+			BVHNode& node{ m_Nodes[nodeIdx] };
+
+			if (node.IsLeaf())
+			{
+				UpdateNodeBounds(static_cast<uint32_t>(nodeIdx));
+				continue;
+			}
+
+			const BVHNode& leftChild{ m_Nodes[node.leftFirst] };
+			const BVHNode& rightChild{ m_Nodes[node.leftFirst + 1] };
+			node.minAABB = Vector3::Min(leftChild.minAABB, rightChild.minAABB);
+			node.maxAABB = Vector3::Max(leftChild.maxAABB, rightChild.maxAABB);
+		}
+	}
+
+	void BVH::UpdateQualityMetrics()
+	{
+		m_Stats.overlap = 0.f;
+		m_Stats.sahCost = 0.f;
+
+		if (m_Nodes.empty())
+			return;
+
+		const float rootArea{ SurfaceArea(m_Nodes[0].minAABB, m_Nodes[0].maxAABB) };
+		const float invRootArea{ rootArea > 0.f ? 1.f / rootArea : 0.f };
+
+		uint32_t innerNodeCount{};
+
+		for (const BVHNode& node : m_Nodes)
+		{
+			const float nodeArea{ SurfaceArea(node.minAABB, node.maxAABB) };
+
+			//Traversal and intersection cost both weighted by the probability of a ray hitting the node
+			if (node.IsLeaf())
+			{
+				m_Stats.sahCost += node.primitiveCount * nodeArea * invRootArea;
+				continue;
+			}
+
+			m_Stats.sahCost += nodeArea * invRootArea;
+
+			const BVHNode& leftChild{ m_Nodes[node.leftFirst] };
+			const BVHNode& rightChild{ m_Nodes[node.leftFirst + 1] };
+
+			const Vector3 overlapMin{ Vector3::Max(leftChild.minAABB, rightChild.minAABB) };
+			const Vector3 overlapMax{ Vector3::Min(leftChild.maxAABB, rightChild.maxAABB) };
+
+			if (nodeArea > 0.f && overlapMin.x <= overlapMax.x && overlapMin.y <= overlapMax.y && overlapMin.z <= overlapMax.z)
+				m_Stats.overlap += SurfaceArea(overlapMin, overlapMax) / nodeArea;
+
+			++innerNodeCount;
+		}
+
+		if (innerNodeCount > 0)
+			m_Stats.overlap /= innerNodeCount;
+	}
+
+	void BVH::Clear()
+	{
+		m_Nodes.clear();
+		m_WideNodes.clear();
+		m_PrimitiveIndices.clear();
+
+		m_Stats.nodeCount = 0;
+		m_Stats.wideNodeCount = 0;
+		m_Stats.overlap = 0.f;
+		m_Stats.sahCost = 0.f;
+	}
+
+	void BVH::UpdateNodeBounds(uint32_t nodeIdx)
+	{
+		BVHNode& node{ m_Nodes[nodeIdx] };
+
+		node.minAABB = Vector3{ FLT_MAX, FLT_MAX, FLT_MAX };
+		node.maxAABB = Vector3{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		for (uint32_t i{}; i < node.primitiveCount; ++i)
+		{
+			const uint32_t primitiveIdx{ m_PrimitiveIndices[node.leftFirst + i] };
+			GrowBounds(node.minAABB, node.maxAABB, m_PrimitiveMin[primitiveIdx], m_PrimitiveMax[primitiveIdx]);
+		}
+	}
+
+	void BVH::Subdivide(uint32_t nodeIdx)
+	{
+		//Copy, m_Nodes grows below
+		const BVHNode node{ m_Nodes[nodeIdx] };
+
+		if (node.primitiveCount <= 1)
+			return;
+
+		int axis{};
+		uint32_t leftCount{};
+		const float splitCost{ FindBestSplit(node, axis, leftCount) };
+
+		//Stop when visiting two children is more expensive than intersecting all primitives of this node
+		const float nodeArea{ SurfaceArea(node.minAABB, node.maxAABB) };
+		const float leafCost{ node.primitiveCount * nodeArea };
+		if (traversalCost * nodeArea + splitCost >= leafCost)
+			return;
+
+		//FindBestSplit leaves the range sorted along the last axis
+		if (axis != 2)
+			SortByCentroid(node, axis);
+
+		const uint32_t leftChildIdx{ static_cast<uint32_t>(m_Nodes.size()) };
+
+		BVHNode leftChild{};
+		leftChild.leftFirst = node.leftFirst;
+		leftChild.primitiveCount = leftCount;
+
+		BVHNode rightChild{};
+		rightChild.leftFirst = node.leftFirst + leftCount;
+		rightChild.primitiveCount = node.primitiveCount - leftCount;
+
+		m_Nodes.emplace_back(leftChild);
+		m_Nodes.emplace_back(rightChild);
+
+		m_Nodes[nodeIdx].leftFirst = leftChildIdx;
+		m_Nodes[nodeIdx].primitiveCount = 0;
+
+		UpdateNodeBounds(leftChildIdx);
+		UpdateNodeBounds(leftChildIdx + 1);
+
+		Subdivide(leftChildIdx);
+		Subdivide(leftChildIdx + 1);
+	}
+
+	float BVH::FindBestSplit(const BVHNode& node, int& bestAxis, uint32_t& bestLeftCount)
+	{
+		float bestCost{ FLT_MAX };
+
+		for (int axis{}; axis < 3; ++axis)
+		{
+			SortByCentroid(node, axis);
+
+			//Sweep right to left, storing the area of everything right of each split
+			Vector3 minAABB{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 maxAABB{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (uint32_t i{ node.primitiveCount - 1 }; i > 0; --i)
+			{
+				const uint32_t primitiveIdx{ m_PrimitiveIndices[node.leftFirst + i] };
+				GrowBounds(minAABB, maxAABB, m_PrimitiveMin[primitiveIdx], m_PrimitiveMax[primitiveIdx]);
+				m_SweepAreas[i] = SurfaceArea(minAABB, maxAABB);
+			}
+
+			//Sweep left to right, evaluating the SAH cost of every split
+			minAABB = Vector3{ FLT_MAX, FLT_MAX, FLT_MAX };
+			maxAABB = Vector3{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (uint32_t leftCount{ 1 }; leftCount < node.primitiveCount; ++leftCount)
+			{
+				const uint32_t primitiveIdx{ m_PrimitiveIndices[node.leftFirst + leftCount - 1] };
+				GrowBounds(minAABB, maxAABB, m_PrimitiveMin[primitiveIdx], m_PrimitiveMax[primitiveIdx]);
+
+				const float cost{ leftCount * SurfaceArea(minAABB, maxAABB)
+					+ (node.primitiveCount - leftCount) * m_SweepAreas[leftCount] };
+
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestLeftCount = leftCount;
+				}
+			}
+		}
+
+		return bestCost;
+	}
+
+	void BVH::SortByCentroid(const BVHNode& node, int axis)
+	{
+		const auto first{ m_PrimitiveIndices.begin() + node.leftFirst };
+		std::sort(first, first + node.primitiveCount, [this, axis](uint32_t a, uint32_t b)
+			{
+				//Tie-break on the id so every sort along an axis yields the same order
+				const float centroidA{ GetAxis(m_Centroids[a], axis) };
+				const float centroidB{ GetAxis(m_Centroids[b], axis) };
+				return centroidA < centroidB || (centroidA == centroidB && a < b);
+			});
+	}
+
+	float BVH::SurfaceArea(const Vector3& minAABB, const Vector3& maxAABB)
+	{
+		const float extentX{ maxAABB.x - minAABB.x };
+		const float extentY{ maxAABB.y - minAABB.y };
+		const float extentZ{ maxAABB.z - minAABB.z };
+		return extentX * extentY + extentY * extentZ + extentZ * extentX;
+	}
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	struct BVHNode
+	{
+		Vector3 minAABB{};
+		Vector3 maxAABB{};
+
+		//Inner node: index of the left child (right child = leftFirst + 1)
+		//Leaf node: index of the first entry in the primitive index list
+		uint32_t leftFirst{};
+		uint32_t primitiveCount{};
+
+		bool IsLeaf() const { return primitiveCount > 0; }
+	};
+
+	//4-wide node collapsed from two levels of the binary hierarchy, traversed with one SSE slab test for all children
+	//Children 0-1 come from one side of the binary split and 2-3 from the other, each pair ordered low to high along its split axis
+	struct alignas(16) BVH4Node
+	{
+		//Child bounds in SoA form
+		float minX[4]{};
+		float minY[4]{};
+		float minZ[4]{};
+		float maxX[4]{};
+		float maxY[4]{};
+		float maxZ[4]{};
+
+		//Inner child: index of its BVH4Node, leaf child: index of the first entry in the primitive index list
+		uint32_t childFirst[4]{};
+		uint32_t childCount[4]{}; //Primitive count of a leaf child, 0 for an inner child
+
+		uint8_t splitAxis[3]{}; //Between pair 0-1 and 2-3, between child 0 and 1, between child 2 and 3
+		uint8_t childMask{}; //Bit per used child slot
+	};
+
+	enum class BVHBuilder
+	{
+		SweepSAH, //Exact SAH over every split candidate, single threaded, O(N log^2 N)
+		BinnedSAH, //SAH evaluated on a fixed number of bins, subtrees built in parallel
+		LBVH //Primitives sorted along a Morton curve, linear time, lower quality: meant for per-frame rebuilds
+	};
+
+	//Bounds of the primitives falling into one bin of the binned builder
+	struct BVHBin
+	{
+		Vector3 minAABB{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 maxAABB{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		uint32_t count{};
+
+		void Grow(const Vector3& primitiveMin, const Vector3& primitiveMax);
+		void Grow(const BVHBin& bin);
+	};
+
+	struct BVHStats
+	{
+		uint32_t nodeCount{};
+		uint32_t wideNodeCount{};
+
+		float lastUpdateMs{}; //Duration of the last Build/Refit call (including a fallback rebuild)
+		bool lastUpdateWasRefit{};
+		uint32_t refitCount{};
+		uint32_t rebuildCount{};
+
+		float overlap{}; //Average fraction of an inner node's area shared by both children [0, 1]
+		float overlapAtBuild{}; //Same metric, measured right after the last full build
+		float sahCost{}; //Expected traversal cost of a random ray hitting the root (Surface Area Heuristic)
+	};
+
+	//Bounding Volume Hierarchy over a set of bounded primitives
+	//Used both per mesh (over its triangles) and per scene (over spheres, triangles and mesh instances)
+	//Built top-down using the Surface Area Heuristic, see BVHBuilder
+	class BVH final
+	{
+	public:
+		BVH() = default;
+		~BVH() = default;
+
+		/**
+		 * \brief (Re)builds the hierarchy over the triangles of a mesh
+		 * \param positions vertex positions the triangles are built from
+		 * \param indices triangle list (3 indices per triangle)
+		 */
+		void Build(const std::vector<Vector3>& positions, const std::vector<int>& indices);
+
+		/**
+		 * \brief (Re)builds the hierarchy over arbitrary primitives
+		 * \param primitiveMin min corner of every primitive's bounding box
+		 * \param primitiveMax max corner of every primitive's bounding box
+		 */
+		void BuildFromBounds(const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax);
+
+		/**
+		 * \brief Updates the node bounds bottom-up while keeping the tree topology
+		 * Falls back to a full build when the primitive count changed, refitting is disabled
+		 * or the overlap grew more than the refit threshold since the last build
+		 */
+		void Refit(const std::vector<Vector3>& positions, const std::vector<int>& indices);
+		void RefitFromBounds(const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax);
+
+		/**
+		 * \brief Takes over a hierarchy built earlier (see Utils::LoadMesh), only the wide nodes and quality metrics are recomputed
+		 * \param nodes, primitiveIndices as returned by GetNodes and GetPrimitiveIndices after a build
+		 */
+		void Load(std::vector<BVHNode>&& nodes, std::vector<uint32_t>&& primitiveIndices);
+		void Clear();
+
+		void SetBuilder(BVHBuilder builder) { m_Builder = builder; }
+		BVHBuilder GetBuilder() const { return m_Builder; }
+
+		//Collapses the binary hierarchy into BVH4Nodes after every build/refit, traversal then uses the wide nodes
+		void SetWideNodesEnabled(bool enabled);
+		bool IsWideNodesEnabled() const { return m_WideNodesEnabled; }
+
+		void SetRefitEnabled(bool enabled) { m_RefitEnabled = enabled; }
+		bool IsRefitEnabled() const { return m_RefitEnabled; }
+		void SetRefitThreshold(float maxOverlapIncrease) { m_RefitThreshold = maxOverlapIncrease; }
+		float GetRefitThreshold() const { return m_RefitThreshold; }
+
+		const BVHStats& GetStats() const { return m_Stats; }
+
+		bool IsEmpty() const { return m_Nodes.empty(); }
+
+		const std::vector<BVHNode>& GetNodes() const { return m_Nodes; }
+		const std::vector<BVH4Node>& GetWideNodes() const { return m_WideNodes; }
+		const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
+
+	private:
+		std::vector<BVHNode> m_Nodes{};
+		std::vector<BVH4Node> m_WideNodes{};
+		std::vector<uint32_t> m_PrimitiveIndices{}; //Primitive ids, leaves reference a range in here
+
+		//Build scratch data, kept around to avoid reallocating on every rebuild
+		std::vector<Vector3> m_PrimitiveMin{};
+		std::vector<Vector3> m_PrimitiveMax{};
+		std::vector<Vector3> m_Centroids{};
+		std::vector<float> m_SweepAreas{};
+		std::vector<uint32_t> m_MortonCodes{}; //Parallel to m_PrimitiveIndices during an LBVH build
+		std::vector<uint32_t> m_SortScratchCodes{};
+		std::vector<uint32_t> m_SortScratchIndices{};
+
+		static constexpr uint32_t binCount{ 16 };
+		static constexpr float traversalCost{ 1.f }; //Cost of visiting an inner node, relative to intersecting one primitive
+		static constexpr uint32_t minParallelSubtreeSize{ 4096 }; //Smaller subtrees are built on the current thread
+		static constexpr int maxParallelDepth{ 6 }; //Up to 2^6 concurrent subtree tasks
+		static constexpr uint32_t minParallelBinningSize{ 65536 }; //Primitives per chunk when binning/sorting in parallel
+		static constexpr uint32_t mortonBitsPerAxis{ 10 }; //30 bit codes
+		static constexpr uint32_t radixBits{ 10 }; //Morton codes are sorted in 3 passes
+		static constexpr uint32_t maxLBVHLeafSize{ 4 };
+
+		BVHStats m_Stats{};
+		BVHBuilder m_Builder{ BVHBuilder::BinnedSAH };
+		bool m_WideNodesEnabled{ true };
+		bool m_RefitEnabled{ true };
+		float m_RefitThreshold{ .1f };
+
+		void GatherTriangleBounds(const std::vector<Vector3>& positions, const std::vector<int>& indices);
+		void GatherBounds(const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax);
+		bool CanRefit(size_t primitiveCount) const;
+
+		void BuildFromScratchData();
+		void RefitFromScratchData();
+		void UpdateQualityMetrics();
+		void UpdateNodeBounds(uint32_t nodeIdx);
+		void Subdivide(uint32_t nodeIdx);
+		void SubdivideBinned(uint32_t nodeIdx, const Vector3& centroidMin, const Vector3& centroidMax, int depth, std::atomic<uint32_t>& nodesUsed);
+		void BinPrimitives(const BVHNode& node, const Vector3& centroidMin, const Vector3& centroidMax, std::array<std::array<BVHBin, binCount>, 3>& bins) const;
+		float FindBestSplit(const BVHNode& node, int& bestAxis, uint32_t& bestLeftCount);
+		void SortByCentroid(const BVHNode& node, int axis);
+		void BuildLBVH();
+		void SortMortonCodes();
+		void SubdivideLBVH(uint32_t nodeIdx, int depth, std::atomic<uint32_t>& nodesUsed);
+		void UpdateBoundsBottomUp();
+		void UpdateWideNodes();
+		uint32_t CollapseNode(uint32_t nodeIdx);
+		int GetSplitAxis(uint32_t leftIdx, uint32_t rightIdx) const;
+		void SetWideChild(uint32_t wideNodeIdx, int slot, uint32_t nodeIdx);
+
+		static uint32_t GetBinIndex(float centroid, float centroidMin, float binScale);
+		static uint32_t GetChunkCount(uint32_t primitiveCount);
+		static uint32_t GetMortonCode(uint32_t x, uint32_t y, uint32_t z);
+		static float SurfaceArea(const Vector3& minAABB, const Vector3& maxAABB);
+	};
+}
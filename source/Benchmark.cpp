@@ -0,0 +1,210 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+
+#include "Profiler.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Timer.h"
+
+namespace dae {
+
+	namespace
+	{
+		//Nearest rank percentile, sortedValues can't be empty
+		float GetPercentile(const std::vector<float>& sortedValues, float percentile)
+		{
+			const size_t rank{ static_cast<size_t>(std::ceil(percentile / 100.f * sortedValues.size())) };
+			return sortedValues[std::clamp<size_t>(rank, 1, sortedValues.size()) - 1];
+		}
+
+		BenchmarkResult RunScene(const std::string& sceneName, Scene& scene, Renderer& renderer, const BenchmarkSettings& settings)
+		{
+			BenchmarkResult result{};
+			result.sceneName = sceneName;
+			result.frameTimesMs.reserve(settings.frameCount);
+
+			Timer timer{};
+			timer.SetFixedTimeStep(settings.timeStep);
+			timer.Start();
+
+			//Camera path: a full left-right sway around the start orientation, sampled by frame index only
+			Camera& camera{ scene.GetCamera() };
+			const float startYaw{ camera.totalYaw };
+			const int totalFrames{ settings.warmupFrames + settings.frameCount };
+
+			double measuredSeconds{};
+			RayStats rayStats{};
+
+			for (int frame{}; frame < totalFrames; ++frame)
+			{
+				timer.Update();
+				camera.totalYaw = startYaw + settings.cameraSwayAngle * TO_RADIANS * sinf(PI_2 * frame / totalFrames);
+
+				const auto start{ std::chrono::high_resolution_clock::now() };
+
+				{
+					PROFILE_ZONE("Scene::Update");
+					scene.Update(&timer);
+				}
+				renderer.Render(&scene);
+
+				const std::chrono::duration<double> duration{ std::chrono::high_resolution_clock::now() - start };
+
+				if (frame < settings.warmupFrames)
+					continue;
+
+				result.frameTimesMs.push_back(static_cast<float>(duration.count() * 1000.0));
+				rayStats += renderer.GetLastFrameRayStats();
+				measuredSeconds += duration.count();
+			}
+
+			std::vector<float> sortedTimes{ result.frameTimesMs };
+			std::sort(sortedTimes.begin(), sortedTimes.end());
+
+			const size_t count{ sortedTimes.size() };
+			result.meanMs = std::accumulate(sortedTimes.begin(), sortedTimes.end(), 0.f) / count;
+			result.medianMs = count % 2 ? sortedTimes[count / 2] : (sortedTimes[count / 2 - 1] + sortedTimes[count / 2]) / 2.f;
+			result.p95Ms = GetPercentile(sortedTimes, 95.f);
+			result.p99Ms = GetPercentile(sortedTimes, 99.f);
+			result.minMs = sortedTimes.front();
+			result.maxMs = sortedTimes.back();
+			result.rayCount = rayStats.rays;
+			result.raysPerSecond = measuredSeconds > 0.0 ? result.rayCount / measuredSeconds : 0.0;
+
+			if (rayStats.rays > 0)
+			{
+				const double rays{ static_cast<double>(rayStats.rays) };
+				result.testsPerRay = rayStats.GetTestCount() / rays;
+				result.boxTestsPerRay = rayStats.boxTests / rays;
+				result.triangleTestsPerRay = rayStats.triangleTests / rays;
+			}
+
+			return result;
+		}
+
+		bool WriteJson(const std::string& path, const BenchmarkSettings& settings, uint32_t threadCount, const std::vector<BenchmarkResult>& results)
+		{
+			std::ofstream file{ path };
+			if (!file)
+				return false;
+
+			file << "{\n"
+				<< "\t\"width\": " << settings.width << ",\n"
+				<< "\t\"height\": " << settings.height << ",\n"
+				<< "\t\"frames\": " << settings.frameCount << ",\n"
+				<< "\t\"warmupFrames\": " << settings.warmupFrames << ",\n"
+				<< "\t\"timeStep\": " << settings.timeStep << ",\n"
+				<< "\t\"threads\": " << threadCount << ",\n"
+				<< "\t\"lightSamples\": " << settings.lightSampleCount << ",\n"
+				<< "\t\"lightCutoff\": " << settings.lightCutoff << ",\n"
+				<< "\t\"refitThreshold\": " << settings.refitThreshold << ",\n"
+				<< "\t\"scenes\": [\n";
+
+			for (size_t i{}; i < results.size(); ++i)
+			{
+				const BenchmarkResult& result{ results[i] };
+
+				file << "\t\t{\n"
+					<< "\t\t\t\"scene\": \"" << result.sceneName << "\",\n"
+					<< "\t\t\t\"meanMs\": " << result.meanMs << ",\n"
+					<< "\t\t\t\"medianMs\": " << result.medianMs << ",\n"
+					<< "\t\t\t\"p95Ms\": " << result.p95Ms << ",\n"
+					<< "\t\t\t\"p99Ms\": " << result.p99Ms << ",\n"
+					<< "\t\t\t\"minMs\": " << result.minMs << ",\n"
+					<< "\t\t\t\"maxMs\": " << result.maxMs << ",\n"
+					<< "\t\t\t\"rays\": " << result.rayCount << ",\n"
+					<< "\t\t\t\"raysPerSecond\": " << static_cast<uint64_t>(result.raysPerSecond) << ",\n"
+					<< "\t\t\t\"testsPerRay\": " << result.testsPerRay << ",\n"
+					<< "\t\t\t\"boxTestsPerRay\": " << result.boxTestsPerRay << ",\n"
+					<< "\t\t\t\"triangleTestsPerRay\": " << result.triangleTestsPerRay << ",\n"
+					<< "\t\t\t\"frameTimesMs\": [";
+
+				for (size_t frame{}; frame < result.frameTimesMs.size(); ++frame)
+				{
+					file << (frame ? ", " : "") << result.frameTimesMs[frame];
+				}
+
+				file << "]\n\t\t}" << (i + 1 < results.size() ? "," : "") << "\n";
+			}
+
+			file << "\t]\n}\n";
+			return static_cast<bool>(file);
+		}
+
+		//One summary row per scene, meant to be appended to a trend sheet
+		bool WriteCsv(const std::string& path, const BenchmarkSettings& settings, uint32_t threadCount, const std::vector<BenchmarkResult>& results)
+		{
+			std::ofstream file{ path };
+			if (!file)
+				return false;
+
+			file << "scene,width,height,frames,threads,mean_ms,median_ms,p95_ms,p99_ms,min_ms,max_ms,rays_per_second,tests_per_ray\n";
+
+			for (const BenchmarkResult& result : results)
+			{
+				file << result.sceneName << ',' << settings.width << ',' << settings.height << ',' << settings.frameCount << ',' << threadCount << ','
+					<< result.meanMs << ',' << result.medianMs << ',' << result.p95Ms << ',' << result.p99Ms << ','
+					<< result.minMs << ',' << result.maxMs << ',' << static_cast<uint64_t>(result.raysPerSecond) << ',' << result.testsPerRay << '\n';
+			}
+
+			return static_cast<bool>(file);
+		}
+	}
+
+	int RunBenchmark(const BenchmarkSettings& settings)
+	{
+		std::vector<std::string> sceneNames{ settings.sceneNames };
+		if (sceneNames.empty())
+			sceneNames.assign(std::begin(builtInSceneNames), std::end(builtInSceneNames));
+
+		Renderer renderer{ settings.width, settings.height };
+		//Every measured frame has to be the same work, accumulation would stop tracing once converged
+		renderer.SetProgressiveEnabled(false);
+		renderer.SetLightSampleCount(settings.lightSampleCount);
+		renderer.SetLightCutoff(settings.lightCutoff);
+		const uint32_t threadCount{ renderer.GetThreadCount() };
+
+		std::vector<BenchmarkResult> results{};
+		results.reserve(sceneNames.size());
+
+		for (const std::string& sceneName : sceneNames)
+		{
+			const std::unique_ptr<Scene> pScene{ CreateScene(sceneName) };
+			if (!pScene)
+			{
+				std::cout << "Unknown scene: " << sceneName << std::endl;
+				return 1;
+			}
+
+			if (settings.refitThreshold >= 0.f)
+				pScene->SetBVHRefitThreshold(settings.refitThreshold);
+			pScene->Initialize();
+
+			results.push_back(RunScene(sceneName, *pScene, renderer, settings));
+
+			const BenchmarkResult& result{ results.back() };
+			std::cout << sceneName << ": mean " << result.meanMs << " ms, median " << result.medianMs << " ms, p95 " << result.p95Ms
+				<< " ms, p99 " << result.p99Ms << " ms, min " << result.minMs << " ms, max " << result.maxMs << " ms, "
+				<< result.raysPerSecond / 1e6 << " Mrays/s, " << result.testsPerRay << " tests/ray" << std::endl;
+		}
+
+		const std::string jsonPath{ settings.outputPath + ".json" };
+		const std::string csvPath{ settings.outputPath + ".csv" };
+
+		if (!WriteJson(jsonPath, settings, threadCount, results) || !WriteCsv(csvPath, settings, threadCount, results))
+		{
+			std::cout << "Could not write " << jsonPath << " / " << csvPath << std::endl;
+			return 1;
+		}
+
+		std::cout << "Benchmark (" << threadCount << " threads) written to " << jsonPath << " and " << csvPath << std::endl;
+		return 0;
+	}
+}
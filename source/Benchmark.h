@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dae
+{
+	struct BenchmarkSettings
+	{
+		int width{ 640 };
+		int height{ 480 };
+		int frameCount{ 100 }; //Measured frames per scene
+		int warmupFrames{ 5 }; //Rendered before measuring, lets BVHs/caches settle
+		float timeStep{ 1.f / 30.f }; //Simulated seconds per frame, scene animation doesn't depend on the frame time
+		float cameraSwayAngle{ 10.f }; //Degrees the camera yaws left and right of its start orientation over the run
+		std::vector<std::string> sceneNames{}; //Empty: all built-in scenes
+		std::string outputPath{ "benchmark" }; //Writes <outputPath>.json and <outputPath>.csv
+		uint32_t lightSampleCount{}; //See Renderer::SetLightSampleCount
+		float lightCutoff{}; //See Renderer::SetLightCutoff
+		float refitThreshold{ -1.f }; //Negative: the BVH default, see Scene::SetBVHRefitThreshold
+	};
+
+	struct BenchmarkResult
+	{
+		std::string sceneName{};
+		std::vector<float> frameTimesMs{};
+
+		float meanMs{};
+		float medianMs{};
+		float p95Ms{};
+		float p99Ms{};
+		float minMs{};
+		float maxMs{};
+		double raysPerSecond{};
+		uint64_t rayCount{};
+
+		//Intersection tests per ray (see RayStats), 0 when the counters are compiled out
+		double testsPerRay{};
+		double boxTestsPerRay{};
+		double triangleTestsPerRay{};
+	};
+
+	/**
+	 * \brief Renders every scene for a fixed number of frames along a fixed camera path with a fixed time step, so runs are comparable
+	 * Frame time = Scene::Update + Renderer::Render, measured per frame
+	 * \return 0 on success, 1 when a scene name is unknown or the results can't be written
+	 */
+	int RunBenchmark(const BenchmarkSettings& settings);
+}
@@ -1,18 +1,25 @@
 #pragma once
 #include <cassert>
+#include <new>
+#include <xmmintrin.h>
 
 #include "Math.h"
+#include "BVH.h"
+#include "Profiler.h"
 #include "vector"
 
 namespace dae
 {
 #pragma region GEOMETRY
+	//Index in the scene's material table (Scene::GetMaterials)
+	using MaterialIndex = uint16_t;
+
 	struct Sphere
 	{
 		Vector3 origin{};
 		float radius{};
 
-		unsigned char materialIndex{ 0 };
+		MaterialIndex materialIndex{ 0 };
 	};
 
 	struct Plane
@@ -20,7 +27,7 @@ namespace dae
 		Vector3 origin{};
 		Vector3 normal{};
 
-		unsigned char materialIndex{ 0 };
+		MaterialIndex materialIndex{ 0 };
 	};
 
 	enum class TriangleCullMode
@@ -51,7 +58,74 @@ namespace dae
 		Vector3 normal{};
 
 		TriangleCullMode cullMode{};
-		unsigned char materialIndex{};
+		MaterialIndex materialIndex{};
+	};
+
+	//Allocates on cache line boundaries, so SIMD loads/streams over the arrays never split a line at the start
+	template<typename T, size_t Alignment = 64>
+	struct AlignedAllocator
+	{
+		using value_type = T;
+
+		template<typename U>
+		struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+		AlignedAllocator() = default;
+		template<typename U>
+		AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+		T* allocate(size_t count)
+		{
+			return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t{ Alignment }));
+		}
+
+		void deallocate(T* pData, size_t)
+		{
+			::operator delete(pData, std::align_val_t{ Alignment });
+		}
+
+		template<typename U>
+		bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+		template<typename U>
+		bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+	};
+
+	using AlignedFloats = std::vector<float, AlignedAllocator<float>>;
+
+	//Intersection data of a mesh's triangles in structure-of-arrays form: first vertex, both edges and the face normal
+	//Computed once from positions/indices, so a triangle test does not gather vertices or recompute edges
+	struct TriangleSoA
+	{
+		AlignedFloats v0X{}, v0Y{}, v0Z{};
+		AlignedFloats edge1X{}, edge1Y{}, edge1Z{};
+		AlignedFloats edge2X{}, edge2Y{}, edge2Z{};
+		AlignedFloats normalX{}, normalY{}, normalZ{};
+
+		size_t Size() const { return v0X.size(); }
+
+		void Resize(size_t triangleCount)
+		{
+			for (AlignedFloats* pArray : { &v0X, &v0Y, &v0Z, &edge1X, &edge1Y, &edge1Z, &edge2X, &edge2Y, &edge2Z, &normalX, &normalY, &normalZ })
+			{
+				pArray->resize(triangleCount);
+			}
+		}
+
+		void Set(size_t triangleIdx, const Vector3& v0, const Vector3& v1, const Vector3& v2, const Vector3& normal)
+		{
+			v0X[triangleIdx] = v0.x;
+			v0Y[triangleIdx] = v0.y;
+			v0Z[triangleIdx] = v0.z;
+			edge1X[triangleIdx] = v1.x - v0.x;
+			edge1Y[triangleIdx] = v1.y - v0.y;
+			edge1Z[triangleIdx] = v1.z - v0.z;
+			edge2X[triangleIdx] = v2.x - v0.x;
+			edge2Y[triangleIdx] = v2.y - v0.y;
+			edge2Z[triangleIdx] = v2.z - v0.z;
+			normalX[triangleIdx] = normal.x;
+			normalY[triangleIdx] = normal.y;
+			normalZ[triangleIdx] = normal.z;
+		}
 	};
 
 	struct TriangleMesh
@@ -76,7 +150,7 @@ namespace dae
 		std::vector<Vector3> positions{};
 		std::vector<Vector3> normals{};
 		std::vector<int> indices{};
-		unsigned char materialIndex{};
+		MaterialIndex materialIndex{};
 
 		TriangleCullMode cullMode{TriangleCullMode::BackFaceCulling};
 
@@ -90,12 +164,27 @@ namespace dae
 		Vector3 transformedminAABB;
 		Vector3 transformedMaxAABB;
 
-		std::vector<Vector3> transformedPositions{};
-		std::vector<Vector3> transformedNormals{};
+		//Object > World (scale * rotation * translation), World > Object and the matrix used for the normals
+		//The triangles themselves stay in object space, rays are transformed instead
+		Matrix transform{};
+		Matrix inverseTransform{};
+		Matrix normalTransform{};
 
 
 		bool slabTestOn{ true };
 
+		//Acceleration structure over the object space positions, never touched when only the transform changes
+		//Topology change (indices) > full rebuild, deformation (positions only) > bottom-up refit
+		BVH bvh{};
+		bool bvhOn{ true };
+		bool topologyDirty{ true };
+		bool positionsDirty{ false };
+		//Incremented whenever the object space data changes, a deformation can keep both the bounds and the transform
+		uint64_t geometryVersion{};
+
+		//What the intersection kernel reads, in BVH leaf order (or triangle order without BVH)
+		//Rebuilt with the BVH, object space so transforms never touch it
+		TriangleSoA triangleData{};
 
 
 
@@ -110,8 +199,13 @@ namespace dae
 			rotationTransform = Matrix::CreateRotationY(yaw);
 		}
 
+		//A zero component has no inverse (object space rays would be inf/NaN), such a scale is ignored
 		void Scale(const Vector3& scale)
 		{
+			assert(scale.x != 0.f && scale.y != 0.f && scale.z != 0.f && "a mesh scale can't be zero");
+			if (scale.x == 0.f || scale.y == 0.f || scale.z == 0.f)
+				return;
+
 			scaleTransform = Matrix::CreateScale(scale);
 		}
 
@@ -129,6 +223,8 @@ namespace dae
 
 			normals.emplace_back(triangle.normal);
 
+			topologyDirty = true;
+
 			//Not ideal, but making sure all vertices are updated
 			if(!ignoreTransformUpdate)
 				UpdateTransforms();
@@ -156,30 +252,42 @@ namespace dae
 
 		void UpdateTransforms()
 		{
+			PROFILE_ZONE("TriangleMesh::UpdateTransforms");
 
-			transformedNormals.clear();
-			transformedPositions.clear();
-
-			transformedNormals.reserve(normals.size());
-			transformedPositions.reserve(positions.size());
-
-			const Matrix finalTransform{ scaleTransform * rotationTransform * translationTransform };
+			//Object space data only needs work when positions/indices changed
+			if (topologyDirty)
+			{
+				UpdateAABB();
 
-			for (auto& p : positions)
+				if (bvhOn)
+					bvh.Build(positions, indices);
+			}
+			else if (positionsDirty)
 			{
-				transformedPositions.emplace_back(finalTransform.TransformPoint(p));
+				UpdateAABB();
+				CalculateNormals();
+
+				if (bvhOn)
+					bvh.Refit(positions, indices);
 			}
 
-			for (auto& n : normals)
+			if (topologyDirty || positionsDirty)
 			{
-				transformedNormals.emplace_back(finalTransform.TransformVector(n).Normalized());
+				UpdateTriangleData();
+				++geometryVersion;
 			}
 
+			topologyDirty = false;
+			positionsDirty = false;
 
-			//Update AABB
-			UpdateTransformedAABB(finalTransform);
+			transform = scaleTransform * rotationTransform * translationTransform;
+			inverseTransform = Matrix::Inverse(transform);
 
+			//Normals transform with the inverse transpose, so non-uniform scales keep them perpendicular
+			normalTransform = Matrix::Transpose(inverseTransform);
 
+			//Update AABB
+			UpdateTransformedAABB(transform);
 		}
 
 		void UpdateAABB()
@@ -203,6 +311,54 @@ namespace dae
 			slabTestOn = on;
 		}
 
+		//Call after moving vertices in positions without changing indices
+		void MarkPositionsDirty()
+		{
+			positionsDirty = true;
+		}
+
+		//Picks the strategy for the next BVH build, LBVH trades trace speed for much faster rebuilds (deforming meshes)
+		void SetBVHBuilder(BVHBuilder builder)
+		{
+			if (builder == bvh.GetBuilder())
+				return;
+
+			bvh.SetBuilder(builder);
+			topologyDirty = true;
+		}
+
+		void SetBVH(bool on)
+		{
+			if (on == bvhOn)
+				return;
+
+			bvhOn = on;
+
+			if (bvhOn)
+				bvh.Build(positions, indices);
+			else
+				bvh.Clear();
+
+			UpdateTriangleData();
+		}
+
+		void UpdateTriangleData()
+		{
+			const size_t triangleCount{ indices.size() / 3 };
+			const bool bvhOrder{ bvhOn && !bvh.IsEmpty() };
+			const std::vector<uint32_t>& primitiveIndices{ bvh.GetPrimitiveIndices() };
+
+			triangleData.Resize(triangleCount);
+
+			for (size_t triangleSlot{}; triangleSlot < triangleCount; ++triangleSlot)
+			{
+				const size_t triangleIdx{ bvhOrder ? primitiveIndices[triangleSlot] : triangleSlot };
+
+				triangleData.Set(triangleSlot, positions[indices[triangleIdx * 3]], positions[indices[triangleIdx * 3 + 1]],
+					positions[indices[triangleIdx * 3 + 2]], normals[triangleIdx]);
+			}
+		}
+
 		void UpdateTransformedAABB(const Matrix& finalTransform)
 		{
 			//AABB update: be careful -> transform the 8 vertices of the AABB
@@ -261,6 +417,7 @@ namespace dae
 		Vector3 direction{};
 		ColorRGB color{};
 		float intensity{};
+		float range{}; //Point lights: nothing past this distance gets lit, 0 = unlimited
 
 		LightType type{};
 	};
@@ -282,7 +439,41 @@ namespace dae
 		float t = FLT_MAX;
 
 		bool didHit{ false };
-		unsigned char materialIndex{ 0 };
+		MaterialIndex materialIndex{ 0 };
+	};
+
+	//4 rays traced together, one per SSE lane (primary rays of a 2x2 pixel block)
+	struct Ray4
+	{
+		Ray4() = default;
+		explicit Ray4(const Ray (&rays)[4]) :
+			originX{ _mm_setr_ps(rays[0].origin.x, rays[1].origin.x, rays[2].origin.x, rays[3].origin.x) },
+			originY{ _mm_setr_ps(rays[0].origin.y, rays[1].origin.y, rays[2].origin.y, rays[3].origin.y) },
+			originZ{ _mm_setr_ps(rays[0].origin.z, rays[1].origin.z, rays[2].origin.z, rays[3].origin.z) },
+			directionX{ _mm_setr_ps(rays[0].direction.x, rays[1].direction.x, rays[2].direction.x, rays[3].direction.x) },
+			directionY{ _mm_setr_ps(rays[0].direction.y, rays[1].direction.y, rays[2].direction.y, rays[3].direction.y) },
+			directionZ{ _mm_setr_ps(rays[0].direction.z, rays[1].direction.z, rays[2].direction.z, rays[3].direction.z) },
+			min{ _mm_setr_ps(rays[0].min, rays[1].min, rays[2].min, rays[3].min) },
+			max{ _mm_setr_ps(rays[0].max, rays[1].max, rays[2].max, rays[3].max) }
+		{}
+
+		__m128 originX{}, originY{}, originZ{};
+		__m128 directionX{}, directionY{}, directionZ{};
+
+		__m128 min{};
+		__m128 max{};
+	};
+
+	//Closest hit per lane of a Ray4, only what is needed to resolve it into a HitRecord afterwards
+	struct HitRecord4
+	{
+		static constexpr uint32_t noHit{ UINT32_MAX };
+
+		__m128 t{ _mm_set1_ps(FLT_MAX) };
+
+		//Caller defined ids of the closest primitive (and triangle within a mesh) per lane
+		uint32_t primitiveIdx[4]{ noHit, noHit, noHit, noHit };
+		uint32_t triangleIdx[4]{};
 	};
 #pragma endregion
 }
\ No newline at end of file
@@ -0,0 +1,551 @@
+//Standalone microbenchmark for the intersection and BRDF kernels, no window, scene or renderer involved
+//Every kernel runs over the same randomized batch, the scalar and 4-wide packet variants side by side
+//Note: the kernels count into RayStats, comment out RAY_STATS_ENABLED to time them without the counters
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BRDFs.h"
+#include "Material.h"
+#include "Utils.h"
+
+using namespace dae;
+
+struct KernelBenchmarkSettings
+{
+	uint32_t rayCount{ 1 << 14 }; //Rounded up to whole packets, one primitive per packet of 4 rays
+	int repetitions{ 64 }; //Passes over the batch per kernel
+	float hitRate{ 0.5f }; //Fraction of the rays aimed at their primitive, the rest are built to miss it
+	uint32_t seed{ 1337 };
+	std::string csvPath{};
+};
+
+struct KernelResult
+{
+	std::string kernel{};
+	std::string variant{};
+	uint64_t testCount{};
+	uint64_t hitCount{};
+	double seconds{};
+	bool hasHitRate{ true };
+
+	double GetNsPerTest() const { return seconds * 1e9 / testCount; }
+	double GetTestsPerSecond() const { return testCount / seconds; }
+};
+
+//Keeps the results alive, so the optimizer can't drop the kernel calls
+volatile float g_Sink{};
+
+#pragma region Random Batches
+class RandomGenerator final
+{
+public:
+	explicit RandomGenerator(uint32_t seed) : m_Engine{ seed } {}
+
+	float Range(float min, float max) { return std::uniform_real_distribution<float>{ min, max }(m_Engine); }
+	bool Chance(float probability) { return Range(0.f, 1.f) < probability; }
+
+	Vector3 UnitVector()
+	{
+		//Rejection sampling keeps the directions uniform
+		while (true)
+		{
+			const Vector3 vector{ Range(-1.f, 1.f), Range(-1.f, 1.f), Range(-1.f, 1.f) };
+			const float sqrMagnitude{ vector.SqrMagnitude() };
+			if (sqrMagnitude > 0.0001f && sqrMagnitude <= 1.f)
+				return vector / sqrtf(sqrMagnitude);
+		}
+	}
+
+	Vector3 InUnitBall()
+	{
+		while (true)
+		{
+			const Vector3 vector{ Range(-1.f, 1.f), Range(-1.f, 1.f), Range(-1.f, 1.f) };
+			if (vector.SqrMagnitude() <= 1.f)
+				return vector;
+		}
+	}
+
+	Vector3 Perpendicular(const Vector3& axis)
+	{
+		while (true)
+		{
+			const Vector3 perpendicular{ Vector3::Cross(axis, UnitVector()) };
+			if (perpendicular.SqrMagnitude() > 0.01f)
+				return perpendicular.Normalized();
+		}
+	}
+
+private:
+	std::mt19937 m_Engine;
+};
+
+struct RayBatch
+{
+	std::vector<Ray> rays{};
+	std::vector<Ray4> packets{}; //The same rays, packet i holds rays 4i..4i+3
+	uint32_t expectedHits{};
+
+	uint32_t GetPacketCount() const { return static_cast<uint32_t>(packets.size()); }
+
+	void Add(const Vector3& origin, const Vector3& target, bool isHit)
+	{
+		rays.push_back(Ray{ origin, (target - origin).Normalized() });
+		expectedHits += isHit;
+
+		if (rays.size() % 4 == 0)
+		{
+			const Ray packetRays[4]{ rays[rays.size() - 4], rays[rays.size() - 3], rays[rays.size() - 2], rays[rays.size() - 1] };
+			packets.emplace_back(packetRays);
+		}
+	}
+};
+
+//Rays towards a bounding sphere: hits aim inside it, misses aim at an offset perpendicular to the view axis that clears it
+//The origin stays at least 5 radii away, which keeps a 1.1 radius offset outside the sphere along the whole ray
+void AddBoundingSphereRay(RandomGenerator& random, RayBatch& batch, const Vector3& center, float radius, bool isHit, float hitScale)
+{
+	const Vector3 origin{ center + random.UnitVector() * radius * random.Range(5.f, 20.f) };
+
+	if (isHit)
+	{
+		batch.Add(origin, center + random.InUnitBall() * radius * hitScale, true);
+		return;
+	}
+
+	const Vector3 axis{ (center - origin).Normalized() };
+	batch.Add(origin, center + random.Perpendicular(axis) * radius * random.Range(1.1f, 3.f), false);
+}
+
+void BuildSphereBatch(const KernelBenchmarkSettings& settings, RandomGenerator& random, uint32_t packetCount, std::vector<Sphere>& spheres, RayBatch& batch)
+{
+	for (uint32_t i{}; i < packetCount; ++i)
+	{
+		const Sphere& sphere{ spheres.emplace_back(Sphere{ Vector3{ random.Range(-50.f, 50.f), random.Range(-50.f, 50.f), random.Range(-50.f, 50.f) }, random.Range(0.5f, 2.f)}) };
+
+		for (int lane{}; lane < 4; ++lane)
+		{
+			AddBoundingSphereRay(random, batch, sphere.origin, sphere.radius, random.Chance(settings.hitRate), 0.9f);
+		}
+	}
+}
+
+void BuildPlaneBatch(const KernelBenchmarkSettings& settings, RandomGenerator& random, uint32_t packetCount, std::vector<Plane>& planes, RayBatch& batch)
+{
+	for (uint32_t i{}; i < packetCount; ++i)
+	{
+		const Plane& plane{ planes.emplace_back(Plane{ Vector3{ random.Range(-50.f, 50.f), random.Range(-50.f, 50.f), random.Range(-50.f, 50.f) }, random.UnitVector() }) };
+
+		for (int lane{}; lane < 4; ++lane)
+		{
+			const Vector3 origin{ plane.origin + plane.normal * random.Range(1.f, 20.f) + random.Perpendicular(plane.normal) * random.Range(0.f, 20.f) };
+
+			//Towards the plane hits, away from it misses, grazing directions are left out so the outcome is certain
+			const bool isHit{ random.Chance(settings.hitRate) };
+			Vector3 direction{};
+			do
+			{
+				direction = random.UnitVector();
+				if ((Vector3::Dot(direction, plane.normal) < 0.f) != isHit)
+					direction = -direction;
+			} while (fabsf(Vector3::Dot(direction, plane.normal)) < 0.05f);
+
+			batch.Add(origin, origin + direction, isHit);
+		}
+	}
+}
+
+void BuildTriangleBatch(const KernelBenchmarkSettings& settings, RandomGenerator& random, uint32_t packetCount, std::vector<Triangle>& triangles, RayBatch& batch)
+{
+	for (uint32_t i{}; i < packetCount; ++i)
+	{
+		const Vector3 v0{ random.Range(-50.f, 50.f), random.Range(-50.f, 50.f), random.Range(-50.f, 50.f) };
+		const Vector3 v1{ v0 + random.UnitVector() * random.Range(0.5f, 3.f) };
+		const Vector3 v2{ v0 + random.UnitVector() * random.Range(0.5f, 3.f) };
+
+		Triangle& triangle{ triangles.emplace_back(v0, v1, v2) };
+		triangle.cullMode = TriangleCullMode::NoCulling;
+
+		const Vector3 edgeV0V1{ v1 - v0 };
+		const Vector3 edgeV0V2{ v2 - v0 };
+		const Vector3 center{ v0 + (edgeV0V1 + edgeV0V2) / 3.f };
+
+		for (int lane{}; lane < 4; ++lane)
+		{
+			const Vector3 origin{ center + triangle.normal * random.Range(-20.f, 20.f) + random.Perpendicular(triangle.normal) * random.Range(0.f, 10.f) };
+
+			//The target lies in the triangle's plane, barycentrics inside (with a margin) hit, outside miss
+			const bool isHit{ random.Chance(settings.hitRate) };
+			float u{}, v{};
+			do
+			{
+				u = random.Range(0.f, 1.f);
+				v = random.Range(0.f, 1.f);
+				if ((u + v <= 1.f) != isHit)
+				{
+					u = 1.f - u;
+					v = 1.f - v;
+				}
+			} while (isHit ? (u < 0.02f || v < 0.02f || u + v > 0.98f) : u + v < 1.05f);
+
+			batch.Add(origin, v0 + u * edgeV0V1 + v * edgeV0V2, isHit);
+		}
+	}
+}
+
+void BuildMeshBoundsBatch(const KernelBenchmarkSettings& settings, RandomGenerator& random, uint32_t packetCount, std::vector<TriangleMesh>& meshes, RayBatch& batch)
+{
+	meshes.resize(packetCount);
+
+	for (TriangleMesh& mesh : meshes)
+	{
+		//Only the world space bounds are read by the slab test
+		const Vector3 center{ random.Range(-50.f, 50.f), random.Range(-50.f, 50.f), random.Range(-50.f, 50.f) };
+		const Vector3 halfExtents{ random.Range(0.5f, 3.f), random.Range(0.5f, 3.f), random.Range(0.5f, 3.f) };
+		mesh.transformedminAABB = center - halfExtents;
+		mesh.transformedMaxAABB = center + halfExtents;
+
+		for (int lane{}; lane < 4; ++lane)
+		{
+			const bool isHit{ random.Chance(settings.hitRate) };
+			if (isHit)
+			{
+				//Any point inside the box
+				const Vector3 origin{ center + random.UnitVector() * halfExtents.Magnitude() * random.Range(5.f, 20.f) };
+				const Vector3 target{ center + Vector3{ halfExtents.x * random.Range(-0.9f, 0.9f), halfExtents.y * random.Range(-0.9f, 0.9f), halfExtents.z * random.Range(-0.9f, 0.9f) } };
+				batch.Add(origin, target, true);
+			}
+			else
+			{
+				AddBoundingSphereRay(random, batch, center, halfExtents.Magnitude(), false, 0.f);
+			}
+		}
+	}
+}
+#pragma endregion
+
+#pragma region Measurement
+//Runs test(idx) for every idx in [0, callCount), repetitions times, test returns its hit count
+template<typename Test>
+KernelResult Measure(const char* kernel, const char* variant, int repetitions, uint32_t callCount, uint32_t testsPerCall, Test&& test)
+{
+	//One untimed pass, so the batch is in cache and the clocks are up
+	for (uint32_t idx{}; idx < callCount; ++idx)
+	{
+		test(idx);
+	}
+
+	uint64_t hitCount{};
+	const auto start{ std::chrono::steady_clock::now() };
+
+	for (int repetition{}; repetition < repetitions; ++repetition)
+	{
+		for (uint32_t idx{}; idx < callCount; ++idx)
+		{
+			hitCount += test(idx);
+		}
+	}
+
+	const std::chrono::duration<double> duration{ std::chrono::steady_clock::now() - start };
+
+	const uint64_t testCount{ static_cast<uint64_t>(repetitions) * callCount * testsPerCall };
+	return KernelResult{ kernel, variant, testCount, hitCount / repetitions, duration.count() };
+}
+
+uint32_t CountHits4(const __m128& hit, const __m128& t, float& tSum)
+{
+	float lanes[4]{};
+	_mm_storeu_ps(lanes, _mm_and_ps(hit, t));
+	tSum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+	const int mask{ _mm_movemask_ps(hit) };
+	return (mask & 1) + (mask >> 1 & 1) + (mask >> 2 & 1) + (mask >> 3 & 1);
+}
+#pragma endregion
+
+#pragma region Kernels
+void RunIntersectionKernels(const KernelBenchmarkSettings& settings, std::vector<KernelResult>& results)
+{
+	using namespace GeometryUtils;
+
+	const uint32_t packetCount{ (settings.rayCount + 3) / 4 };
+	const int repetitions{ settings.repetitions };
+	float tSum{};
+
+	{
+		RandomGenerator random{ settings.seed };
+		std::vector<Sphere> spheres{};
+		RayBatch batch{};
+		BuildSphereBatch(settings, random, packetCount, spheres, batch);
+
+		results.push_back(Measure("HitTest_Sphere", "scalar", repetitions, packetCount * 4, 1, [&](uint32_t idx)
+			{
+				float t{};
+				const bool hit{ HitTest_Sphere(spheres[idx / 4], batch.rays[idx], t) };
+				tSum += hit ? t : 0.f;
+				return static_cast<uint32_t>(hit);
+			}));
+		results.push_back(Measure("HitTest_Sphere", "sse4", repetitions, packetCount, 4, [&](uint32_t idx)
+			{
+				__m128 t{};
+				return CountHits4(HitTest_Sphere4(spheres[idx], batch.packets[idx], t), t, tSum);
+			}));
+	}
+
+	{
+		RandomGenerator random{ settings.seed };
+		std::vector<Plane> planes{};
+		RayBatch batch{};
+		BuildPlaneBatch(settings, random, packetCount, planes, batch);
+
+		results.push_back(Measure("HitTest_Plane", "scalar", repetitions, packetCount * 4, 1, [&](uint32_t idx)
+			{
+				float t{};
+				const bool hit{ HitTest_Plane(planes[idx / 4], batch.rays[idx], t) };
+				tSum += hit ? t : 0.f;
+				return static_cast<uint32_t>(hit);
+			}));
+		results.push_back(Measure("HitTest_Plane", "sse4", repetitions, packetCount, 4, [&](uint32_t idx)
+			{
+				__m128 t{};
+				return CountHits4(HitTest_Plane4(planes[idx], batch.packets[idx], t), t, tSum);
+			}));
+	}
+
+	{
+		RandomGenerator random{ settings.seed };
+		std::vector<Triangle> triangles{};
+		RayBatch batch{};
+		BuildTriangleBatch(settings, random, packetCount, triangles, batch);
+
+		results.push_back(Measure("HitTest_Triangle", "scalar", repetitions, packetCount * 4, 1, [&](uint32_t idx)
+			{
+				float t{};
+				const bool hit{ HitTest_Triangle(triangles[idx / 4], batch.rays[idx], t) };
+				tSum += hit ? t : 0.f;
+				return static_cast<uint32_t>(hit);
+			}));
+		results.push_back(Measure("HitTest_Triangle", "sse4", repetitions, packetCount, 4, [&](uint32_t idx)
+			{
+				__m128 t{};
+				return CountHits4(HitTest_Triangle4(triangles[idx], batch.packets[idx], t), t, tSum);
+			}));
+	}
+
+	{
+		RandomGenerator random{ settings.seed };
+		std::vector<TriangleMesh> meshes{};
+		RayBatch batch{};
+		BuildMeshBoundsBatch(settings, random, packetCount, meshes, batch);
+
+		results.push_back(Measure("SlabTest_TriangleMesh", "scalar", repetitions, packetCount * 4, 1, [&](uint32_t idx)
+			{
+				return static_cast<uint32_t>(SlabTest_TriangleMesh(meshes[idx / 4], batch.rays[idx]));
+			}));
+		results.push_back(Measure("SlabTest_TriangleMesh", "sse4", repetitions, packetCount, 4, [&](uint32_t idx)
+			{
+				const __m128 hit{ SlabTest_TriangleMesh4(meshes[idx], batch.packets[idx]) };
+				return CountHits4(hit, _mm_setzero_ps(), tSum);
+			}));
+	}
+
+	g_Sink = tSum;
+}
+
+void RunBRDFKernels(const KernelBenchmarkSettings& settings, std::vector<KernelResult>& results)
+{
+	const uint32_t sampleCount{ settings.rayCount };
+	const int repetitions{ settings.repetitions };
+
+	//Shading inputs as the Renderer passes them: l towards the light, v from the eye, both on the normal's side
+	RandomGenerator random{ settings.seed };
+	std::vector<Vector3> normals{}, lightDirections{}, viewDirections{};
+	std::vector<float> roughness{};
+	normals.reserve(sampleCount);
+	lightDirections.reserve(sampleCount);
+	viewDirections.reserve(sampleCount);
+	roughness.reserve(sampleCount);
+
+	for (uint32_t i{}; i < sampleCount; ++i)
+	{
+		const Vector3 normal{ random.UnitVector() };
+		Vector3 l{ random.UnitVector() };
+		if (Vector3::Dot(l, normal) < 0.f)
+			l = -l;
+		Vector3 v{ random.UnitVector() };
+		if (Vector3::Dot(v, normal) > 0.f)
+			v = -v;
+
+		normals.push_back(normal);
+		lightDirections.push_back(l);
+		viewDirections.push_back(v);
+		roughness.push_back(random.Range(0.05f, 1.f));
+	}
+
+	const ColorRGB albedo{ 0.955f, 0.637f, 0.538f };
+	float sum{};
+
+	const auto addColor{ [&sum](const ColorRGB& color) { sum += color.r + color.g + color.b; return 0u; } };
+
+	results.push_back(Measure("BRDF::Lambert", "scalar", repetitions, sampleCount, 1, [&](uint32_t idx)
+		{
+			return addColor(BRDF::Lambert(roughness[idx], albedo));
+		}));
+	results.push_back(Measure("BRDF::Phong", "scalar", repetitions, sampleCount, 1, [&](uint32_t idx)
+		{
+			return addColor(BRDF::Phong(0.5f, 60.f * roughness[idx], lightDirections[idx], viewDirections[idx], normals[idx]));
+		}));
+	results.push_back(Measure("BRDF::FresnelFunction_Schlick", "scalar", repetitions, sampleCount, 1, [&](uint32_t idx)
+		{
+			return addColor(BRDF::FresnelFunction_Schlick(normals[idx], -viewDirections[idx], albedo));
+		}));
+	results.push_back(Measure("BRDF::NormalDistribution_GGX", "scalar", repetitions, sampleCount, 1, [&](uint32_t idx)
+		{
+			const Vector3 h{ Vector3{ lightDirections[idx] - viewDirections[idx] }.Normalized() };
+			sum += BRDF::NormalDistribution_GGX(normals[idx], h, roughness[idx]);
+			return 0u;
+		}));
+	results.push_back(Measure("BRDF::GeometryFunction_Smith", "scalar", repetitions, sampleCount, 1, [&](uint32_t idx)
+		{
+			sum += BRDF::GeometryFunction_Smith(normals[idx], viewDirections[idx], lightDirections[idx], roughness[idx]);
+			return 0u;
+		}));
+
+	const Material cookTorrance{ Material::CookTorrance(albedo, 0.f, 0.4f) };
+	results.push_back(Measure("Material::Shade (CookTorrance)", "scalar", repetitions, sampleCount, 1, [&](uint32_t idx)
+		{
+			HitRecord hitRecord{};
+			hitRecord.normal = normals[idx];
+			return addColor(cookTorrance.Shade(hitRecord, lightDirections[idx], viewDirections[idx]));
+		}));
+
+	for (size_t i{ results.size() - 6 }; i < results.size(); ++i)
+	{
+		results[i].hasHitRate = false;
+	}
+
+	g_Sink = sum;
+}
+#pragma endregion
+
+#pragma region Report
+void PrintResults(const KernelBenchmarkSettings& settings, const std::vector<KernelResult>& results)
+{
+	std::cout << "Rays per batch: " << (settings.rayCount + 3) / 4 * 4 << ", repetitions: " << settings.repetitions
+		<< ", requested hit rate: " << settings.hitRate * 100.f << "%, seed: " << settings.seed << "\n\n";
+
+	std::cout << std::left << std::setw(32) << "kernel" << std::setw(8) << "variant"
+		<< std::right << std::setw(10) << "ns/test" << std::setw(14) << "Mtests/s" << std::setw(10) << "hit %" << std::setw(10) << "speedup" << '\n';
+
+	std::cout << std::fixed;
+
+	for (size_t i{}; i < results.size(); ++i)
+	{
+		const KernelResult& result{ results[i] };
+		const uint64_t testsPerPass{ result.testCount / settings.repetitions };
+
+		std::cout << std::left << std::setw(32) << result.kernel << std::setw(8) << result.variant << std::right
+			<< std::setprecision(3) << std::setw(10) << result.GetNsPerTest()
+			<< std::setprecision(1) << std::setw(14) << result.GetTestsPerSecond() / 1e6;
+
+		if (result.hasHitRate)
+			std::cout << std::setw(10) << 100.0 * result.hitCount / testsPerPass;
+		else
+			std::cout << std::setw(10) << "-";
+
+		//Relative to the scalar row of the same kernel
+		if (i > 0 && result.variant != "scalar" && results[i - 1].kernel == result.kernel)
+			std::cout << std::setprecision(2) << std::setw(9) << results[i - 1].GetNsPerTest() / result.GetNsPerTest() << 'x';
+
+		std::cout << '\n';
+	}
+
+	std::cout.unsetf(std::ios::fixed);
+	std::cout << std::setprecision(6) << std::endl;
+}
+
+bool WriteCsv(const std::string& path, const KernelBenchmarkSettings& settings, const std::vector<KernelResult>& results)
+{
+	std::ofstream file{ path };
+	if (!file)
+		return false;
+
+	file << "kernel,variant,rays,repetitions,requested_hit_rate,ns_per_test,tests_per_second,hit_rate\n";
+
+	for (const KernelResult& result : results)
+	{
+		file << result.kernel << ',' << result.variant << ',' << (settings.rayCount + 3) / 4 * 4 << ',' << settings.repetitions << ','
+			<< settings.hitRate << ',' << result.GetNsPerTest() << ',' << static_cast<uint64_t>(result.GetTestsPerSecond()) << ',';
+
+		if (result.hasHitRate)
+			file << static_cast<double>(result.hitCount) / (result.testCount / settings.repetitions);
+
+		file << '\n';
+	}
+
+	return static_cast<bool>(file);
+}
+#pragma endregion
+
+void PrintUsage()
+{
+	std::cout << "Usage: KernelBenchmark [--rays 16384] [--repetitions 64] [--hit-rate 0.5] [--seed 1337] [--csv path]" << std::endl;
+}
+
+bool ParseArguments(int argc, char* args[], KernelBenchmarkSettings& settings)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const bool hasValue = i + 1 < argc;
+
+		if (strcmp(args[i], "--rays") == 0 && hasValue)
+			settings.rayCount = static_cast<uint32_t>(std::atoi(args[++i]));
+		else if (strcmp(args[i], "--repetitions") == 0 && hasValue)
+			settings.repetitions = std::atoi(args[++i]);
+		else if (strcmp(args[i], "--hit-rate") == 0 && hasValue)
+			settings.hitRate = static_cast<float>(std::atof(args[++i]));
+		else if (strcmp(args[i], "--seed") == 0 && hasValue)
+			settings.seed = static_cast<uint32_t>(std::atoi(args[++i]));
+		else if (strcmp(args[i], "--csv") == 0 && hasValue)
+			settings.csvPath = args[++i];
+		else
+			return false;
+	}
+
+	return settings.rayCount > 0 && settings.repetitions > 0 && settings.hitRate >= 0.f && settings.hitRate <= 1.f;
+}
+
+int main(int argc, char* args[])
+{
+	KernelBenchmarkSettings settings{};
+	if (!ParseArguments(argc, args, settings))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	std::vector<KernelResult> results{};
+	RunIntersectionKernels(settings, results);
+	RunBRDFKernels(settings, results);
+
+	PrintResults(settings, results);
+
+	if (!settings.csvPath.empty())
+	{
+		if (!WriteCsv(settings.csvPath, settings, results))
+		{
+			std::cout << "Could not write " << settings.csvPath << std::endl;
+			return 1;
+		}
+
+		std::cout << "Results written to " << settings.csvPath << std::endl;
+	}
+
+	return 0;
+}
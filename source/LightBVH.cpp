@@ -0,0 +1,142 @@
+#include "LightBVH.h"
+
+#include <algorithm>
+#include <cfloat>
+
+namespace dae {
+
+	namespace
+	{
+		float GetAxis(const Vector3& v, int axis)
+		{
+			return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+		}
+
+		//Lights right on top of a shading point would otherwise get an infinite importance
+		constexpr float minImportanceDistanceSqr{ 1e-4f };
+
+		//Largest float below 1, the rescaled random number of the walk has to stay in [0, 1)
+		constexpr float oneMinusEpsilon{ 0x1.fffffep-1f };
+	}
+
+	void LightBVH::Build(const std::vector<Light>& lights)
+	{
+		m_Nodes.clear();
+		m_DirectionalLights.clear();
+
+		std::vector<uint32_t> pointLights{};
+		for (uint32_t lightIdx{}; lightIdx < lights.size(); ++lightIdx)
+		{
+			if (lights[lightIdx].type == LightType::Directional)
+				m_DirectionalLights.push_back(lightIdx);
+			else
+				pointLights.push_back(lightIdx);
+		}
+
+		m_PointLightCount = static_cast<uint32_t>(pointLights.size());
+		if (pointLights.empty())
+			return;
+
+		//One leaf per light: 2n - 1 nodes, reserved up front so node references stay valid while building
+		m_Nodes.reserve(2 * pointLights.size() - 1);
+		m_Nodes.emplace_back();
+		BuildRecursive(lights, pointLights, 0, m_PointLightCount, 0);
+	}
+
+	void LightBVH::BuildRecursive(const std::vector<Light>& lights, std::vector<uint32_t>& lightIndices, uint32_t begin, uint32_t end, uint32_t nodeIdx)
+	{
+		LightBVHNode node{};
+		node.minAABB = Vector3{ FLT_MAX, FLT_MAX, FLT_MAX };
+		node.maxAABB = Vector3{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		for (uint32_t i{ begin }; i < end; ++i)
+		{
+			const Light& light{ lights[lightIndices[i]] };
+			node.minAABB = Vector3::Min(node.minAABB, light.origin);
+			node.maxAABB = Vector3::Max(node.maxAABB, light.origin);
+			node.power += light.intensity * (light.color.r + light.color.g + light.color.b) / 3.f;
+		}
+
+		if (end - begin == 1)
+		{
+			node.isLeaf = true;
+			node.leftFirst = lightIndices[begin];
+			m_Nodes[nodeIdx] = node;
+			return;
+		}
+
+		//Median split keeps the tree balanced, so a walk is log2(n) steps whatever the light layout
+		const Vector3 extent{ node.maxAABB - node.minAABB };
+		const int axis{ extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2 };
+		const uint32_t middle{ begin + (end - begin) / 2 };
+
+		std::nth_element(lightIndices.begin() + begin, lightIndices.begin() + middle, lightIndices.begin() + end, [&](uint32_t a, uint32_t b)
+			{
+				return GetAxis(lights[a].origin, axis) < GetAxis(lights[b].origin, axis);
+			});
+
+		node.leftFirst = static_cast<uint32_t>(m_Nodes.size());
+		m_Nodes[nodeIdx] = node;
+		m_Nodes.emplace_back();
+		m_Nodes.emplace_back();
+
+		BuildRecursive(lights, lightIndices, begin, middle, node.leftFirst);
+		BuildRecursive(lights, lightIndices, middle, end, node.leftFirst + 1);
+	}
+
+	bool LightBVH::Sample(const Vector3& origin, const Vector3& normal, float random, uint32_t& lightIdx, float& pdf) const
+	{
+		if (m_Nodes.empty())
+			return false;
+
+		uint32_t nodeIdx{};
+		pdf = 1.f;
+
+		while (!m_Nodes[nodeIdx].isLeaf)
+		{
+			const uint32_t leftIdx{ m_Nodes[nodeIdx].leftFirst };
+			const float leftImportance{ GetImportance(m_Nodes[leftIdx], origin, normal) };
+			const float rightImportance{ GetImportance(m_Nodes[leftIdx + 1], origin, normal) };
+
+			const float totalImportance{ leftImportance + rightImportance };
+			if (totalImportance <= 0.f)
+				return false;
+
+			//Rescaling the random number to the picked child's share keeps it uniform for the next level
+			const float leftProbability{ leftImportance / totalImportance };
+			if (random < leftProbability)
+			{
+				nodeIdx = leftIdx;
+				pdf *= leftProbability;
+				random /= leftProbability;
+			}
+			else
+			{
+				nodeIdx = leftIdx + 1;
+				pdf *= 1.f - leftProbability;
+				random = (random - leftProbability) / (1.f - leftProbability);
+			}
+
+			random = std::min(random, oneMinusEpsilon);
+		}
+
+		lightIdx = m_Nodes[nodeIdx].leftFirst;
+		return true;
+	}
+
+	float LightBVH::GetImportance(const LightBVHNode& node, const Vector3& origin, const Vector3& normal)
+	{
+		const Vector3 halfExtent{ (node.maxAABB - node.minAABB) * .5f };
+		const Vector3 toCenter{ (node.minAABB + node.maxAABB) * .5f - origin };
+
+		//Furthest any point of the box gets above the surface, nothing in the box can light it when that isn't positive
+		const float maxHeight{ Vector3::Dot(normal, toCenter)
+			+ abs(normal.x) * halfExtent.x + abs(normal.y) * halfExtent.y + abs(normal.z) * halfExtent.z };
+		if (maxHeight <= 0.f)
+			return 0.f;
+
+		//Inside or close to a big node the distance to its center means little, its size takes over
+		const float distanceSqr{ std::max(toCenter.SqrMagnitude(), halfExtent.SqrMagnitude()) };
+		return node.power / std::max(distanceSqr, minImportanceDistanceSqr);
+	}
+}
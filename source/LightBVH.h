@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "DataTypes.h"
+#include "Math.h"
+
+namespace dae
+{
+	struct LightBVHNode
+	{
+		Vector3 minAABB{};
+		Vector3 maxAABB{};
+		float power{}; //Sum of the intensity * average color of the lights below
+
+		//Inner node: index of the left child (right child = leftFirst + 1)
+		//Leaf node: index of its light in the scene's light list
+		uint32_t leftFirst{};
+		bool isLeaf{};
+	};
+
+	//Hierarchy over the point lights of a scene, used to pick a light with a probability close to its contribution at a shading point
+	//Directional lights can't be bounded, they stay out of the tree and are always shaded
+	class LightBVH final
+	{
+	public:
+		LightBVH() = default;
+		~LightBVH() = default;
+
+		//Median split on the longest axis down to one light per leaf
+		void Build(const std::vector<Light>& lights);
+
+		/**
+		 * \brief Walks down the tree picking a child with a probability proportional to its importance (power over distance squared,
+		 * zero when the whole node lies behind the surface), one random number drives the whole walk
+		 * \param random uniform in [0, 1)
+		 * \param lightIdx receives an index in the light list the tree was built from
+		 * \param pdf receives the probability lightIdx was picked with, divide its contribution by it for an unbiased estimate
+		 * \return false when no point light can light the surface
+		 */
+		bool Sample(const Vector3& origin, const Vector3& normal, float random, uint32_t& lightIdx, float& pdf) const;
+
+		bool IsEmpty() const { return m_Nodes.empty(); }
+		//Point lights in the tree
+		uint32_t GetPointLightCount() const { return m_PointLightCount; }
+		//Indices of the lights left out of the tree
+		const std::vector<uint32_t>& GetDirectionalLights() const { return m_DirectionalLights; }
+
+	private:
+		std::vector<LightBVHNode> m_Nodes{};
+		std::vector<uint32_t> m_DirectionalLights{};
+		uint32_t m_PointLightCount{};
+
+		void BuildRecursive(const std::vector<Light>& lights, std::vector<uint32_t>& lightIndices, uint32_t begin, uint32_t end, uint32_t nodeIdx);
+		static float GetImportance(const LightBVHNode& node, const Vector3& origin, const Vector3& normal);
+	};
+}
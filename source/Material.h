@@ -1,148 +1,125 @@
 #pragma once
+#include <cstdint>
+
 #include "Math.h"
 #include "DataTypes.h"
 #include "BRDFs.h"
 
 namespace dae
 {
-#pragma region Material BASE
-	class Material
+	enum class MaterialType : uint8_t
 	{
-	public:
-		Material() = default;
-		virtual ~Material() = default;
-
-		Material(const Material&) = delete;
-		Material(Material&&) noexcept = delete;
-		Material& operator=(const Material&) = delete;
-		Material& operator=(Material&&) noexcept = delete;
-
-		/**
-		 * \brief Function used to calculate the correct color for the specific material and its parameters
-		 * \param hitRecord current hitrecord
-		 * \param l light direction
-		 * \param v view direction
-		 * \return color
-		 */
-		virtual ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) = 0;
+		SolidColor,
+		Lambert,
+		LambertPhong,
+		CookTorrance
 	};
-#pragma endregion
 
-#pragma region Material SOLID COLOR
-	//SOLID COLOR
-	//===========
-	class Material_SolidColor final : public Material
+	/**
+	 * \brief Every material model as one value type, a scene keeps them in a contiguous table indexed by MaterialIndex
+	 * The type tag picks the BRDF in Shade, a switch the compiler can inline instead of a virtual call per shaded light
+	 * Whatever only depends on the material's parameters is computed once, by the factory functions
+	 */
+	struct Material
 	{
-	public:
-		Material_SolidColor(const ColorRGB& color): m_Color(color)
+		static Material SolidColor(const ColorRGB& color)
 		{
+			Material material{};
+			material.type = MaterialType::SolidColor;
+			material.diffuse = color;
+			return material;
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) override
+		static Material Lambert(const ColorRGB& diffuseColor, float diffuseReflectance)
 		{
-			return m_Color;
+			Material material{};
+			material.type = MaterialType::Lambert;
+			material.diffuse = BRDF::Lambert(diffuseReflectance, diffuseColor);
+			return material;
 		}
 
-	private:
-		ColorRGB m_Color{colors::White};
-	};
-#pragma endregion
-
-#pragma region Material LAMBERT
-	//LAMBERT
-	//=======
-	class Material_Lambert final : public Material
-	{
-	public:
-		Material_Lambert(const ColorRGB& diffuseColor, float diffuseReflectance) :
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(diffuseReflectance){}
-
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		static Material LambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float phongExponent)
 		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor);
+			Material material{};
+			material.type = MaterialType::LambertPhong;
+			material.diffuse = BRDF::Lambert(kd, diffuseColor);
+			material.specularReflectance = ks;
+			material.phongExponent = phongExponent;
+			return material;
 		}
 
-	private:
-		ColorRGB m_DiffuseColor{colors::White};
-		float m_DiffuseReflectance{1.f}; //kd
-	};
-#pragma endregion
-
-#pragma region Material LAMBERT PHONG
-	//LAMBERT-PHONG
-	//=============
-	class Material_LambertPhong final : public Material
-	{
-	public:
-		Material_LambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float phongExponent):
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(kd), m_SpecularReflectance(ks),
-			m_PhongExponent(phongExponent)
+		//roughness: [1.0 > 0.0] >> [ROUGH > SMOOTH]
+		static Material CookTorrance(const ColorRGB& albedo, float metalness, float roughness)
 		{
+			Material material{};
+			material.type = MaterialType::CookTorrance;
+			material.diffuse = albedo;
+			material.isMetal = metalness != 0.f;
+			material.f0 = material.isMetal ? albedo : ColorRGB{ .04f, .04f, .04f };
+
+			//Both remaps square the roughness first (UE4)
+			const float a = roughness * roughness;
+			material.ggxAlpha2 = a * a;
+			material.smithK = ((a + 1.f) * (a + 1.f)) / 8;
+			return material;
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		/**
+		 * \brief Function used to calculate the correct color for the material and its parameters
+		 * \param hitRecord current hitrecord
+		 * \param l light direction
+		 * \param v view direction
+		 * \return color
+		 */
+		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
 		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor) 
-				+ BRDF::Phong(m_SpecularReflectance, m_PhongExponent, l, v, hitRecord.normal);
+			switch (type)
+			{
+			case MaterialType::SolidColor:
+			case MaterialType::Lambert:
+				return diffuse;
+			case MaterialType::LambertPhong:
+				return diffuse + BRDF::Phong(specularReflectance, phongExponent, l, v, hitRecord.normal);
+			case MaterialType::CookTorrance:
+				return ShadeCookTorrance(hitRecord, l, v);
+			}
+
+			return diffuse;
 		}
 
-	private:
-		ColorRGB m_DiffuseColor{colors::White};
-		float m_DiffuseReflectance{0.5f}; //kd
-		float m_SpecularReflectance{0.5f}; //ks
-		float m_PhongExponent{1.f}; //Phong Exponent
-	};
-#pragma endregion
+		MaterialType type{};
+		bool isMetal{}; //CookTorrance: no diffuse term
 
-#pragma region Material COOK TORRENCE
-	//COOK TORRENCE
-	class Material_CookTorrence final : public Material
-	{
-	public:
-		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness):
-			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness)
-		{
-		}
+		//SolidColor: the color, Lambert/LambertPhong: the constant Lambert term, CookTorrance: the albedo
+		ColorRGB diffuse{};
+		//CookTorrance: base reflectivity, the albedo for metals and .04 for dielectrics
+		ColorRGB f0{};
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
-		{
-			//determine f0 value, metal or not
-			ColorRGB f0 = m_Albedo;
-			if (m_Metalness == 0)
-				f0 = ColorRGB(0.04f, 0.04f, 0.04f);
+		float specularReflectance{}; //LambertPhong: ks
+		float phongExponent{}; //LambertPhong
 
-			//calculate half vector between view direction and light direction
-			Vector3 h = Vector3{ -v + l }.Normalized();
-
-			//Calculate Fresnel
-			ColorRGB F = BRDF::FresnelFunction_Schlick(hitRecord.normal, -v, f0);
+		float ggxAlpha2{}; //CookTorrance: roughness^4, see BRDF::NormalDistribution_GGX
+		float smithK{}; //CookTorrance: roughness remapped for direct lighting, see BRDF::GeometryFunction_Smith
 
-			//Calculate Normal Distribution
-			float D = BRDF::NormalDistribution_GGX(hitRecord.normal, h, m_Roughness);
+	private:
+		ColorRGB ShadeCookTorrance(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
+		{
+			//calculate half vector between view direction and light direction
+			const Vector3 h = Vector3{ -v + l }.Normalized();
 
-			//Calculate Geometry
-			float G = BRDF::GeometryFunction_Smith(hitRecord.normal, v, l, m_Roughness);
+			const ColorRGB F = BRDF::FresnelFunction_Schlick(hitRecord.normal, -v, f0);
+			const float D = BRDF::NormalDistribution_GGX_Alpha2(hitRecord.normal, h, ggxAlpha2);
+			const float G = BRDF::GeometryFunction_Smith_K(hitRecord.normal, v, l, smithK);
 
-			//Calculate Specular
 			ColorRGB specular = D * F * G;
-			specular /= (4 * (Vector3::Dot(-v , hitRecord.normal) * Vector3::Dot(l , hitRecord.normal)));
+			specular /= (4 * (Vector3::Dot(-v, hitRecord.normal) * Vector3::Dot(l, hitRecord.normal)));
 
-			//Determine kd
-			ColorRGB kd = {0, 0 , 0};
+			//Metals absorb whatever they don't reflect
+			if (isMetal)
+				return specular;
 
-			if (m_Metalness == 0)
-				kd = ColorRGB{ 1.f, 1.f, 1.f} - F;
-
-			//Calculate Diffuse
-			ColorRGB diffuse = BRDF::Lambert(kd, m_Albedo);
-
-			return  diffuse + specular;
+			const ColorRGB kd = ColorRGB{ 1.f, 1.f, 1.f } - F;
+			return BRDF::Lambert(kd, diffuse) + specular;
 		}
-
-	private:
-		ColorRGB m_Albedo{0.955f, 0.637f, 0.538f}; //Copper
-		float m_Metalness{1.0f};
-		float m_Roughness{0.1f}; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
 	};
-#pragma endregion
 }
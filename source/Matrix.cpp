@@ -83,6 +83,51 @@ namespace dae {
 		return out;
 	}
 
+	//Inverse of an affine transform (rotation/scale in the upper 3x3 + translation in the last row)
+	const Matrix& Matrix::Inverse()
+	{
+		const Vector3 x{ data[0] };
+		const Vector3 y{ data[1] };
+		const Vector3 z{ data[2] };
+		const Vector3 t{ data[3] };
+
+		//Rows of the inverse 3x3 are the cross products of the axes, divided by the determinant
+		const Vector3 yz{ Vector3::Cross(y, z) };
+		const Vector3 zx{ Vector3::Cross(z, x) };
+		const Vector3 xy{ Vector3::Cross(x, y) };
+
+		//Relative to the axis lengths: the determinant is cubic in the scale, a uniformly tiny scale is still invertible
+		const float determinant{ Vector3::Dot(x, yz) };
+		assert(abs(determinant) > FLT_EPSILON * x.Magnitude() * y.Magnitude() * z.Magnitude());
+		const float invDeterminant{ 1.f / determinant };
+
+		const Vector3 invX{ yz.x * invDeterminant, zx.x * invDeterminant, xy.x * invDeterminant };
+		const Vector3 invY{ yz.y * invDeterminant, zx.y * invDeterminant, xy.y * invDeterminant };
+		const Vector3 invZ{ yz.z * invDeterminant, zx.z * invDeterminant, xy.z * invDeterminant };
+
+		//Translation has to be undone in the rotated/scaled space
+		const Vector3 invT{
+			-(t.x * invX.x + t.y * invY.x + t.z * invZ.x),
+			-(t.x * invX.y + t.y * invY.y + t.z * invZ.y),
+			-(t.x * invX.z + t.y * invY.z + t.z * invZ.z)
+		};
+
+		data[0] = { invX, 0 };
+		data[1] = { invY, 0 };
+		data[2] = { invZ, 0 };
+		data[3] = { invT, 1 };
+
+		return *this;
+	}
+
+	Matrix Matrix::Inverse(const Matrix& m)
+	{
+		Matrix out{ m };
+		out.Inverse();
+
+		return out;
+	}
+
 	Vector3 Matrix::GetAxisX() const
 	{
 		return data[0];
@@ -174,6 +219,20 @@ namespace dae {
 		return data[index];
 	}
 
+	bool Matrix::operator==(const Matrix& m) const
+	{
+		for (int r{ 0 }; r < 4; ++r)
+		{
+			for (int c{ 0 }; c < 4; ++c)
+			{
+				if (data[r][c] != m.data[r][c])
+					return false;
+			}
+		}
+
+		return true;
+	}
+
 	Matrix Matrix::operator*(const Matrix& m) const
 	{
 		Matrix result{};
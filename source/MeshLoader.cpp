@@ -0,0 +1,628 @@
+#include "MeshLoader.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <thread>
+#include <type_traits>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dae {
+
+#pragma region MappedFile
+#if defined(_WIN32)
+	MappedFile::MappedFile(const std::string& path)
+	{
+		const HANDLE file{ CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr) };
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+
+		m_FileHandle = file;
+
+		LARGE_INTEGER size{};
+		if (!GetFileSizeEx(file, &size))
+			return;
+
+		m_Size = static_cast<size_t>(size.QuadPart);
+		if (m_Size == 0)
+		{
+			//Can't map an empty file
+			m_IsOpen = true;
+			return;
+		}
+
+		m_MappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_MappingHandle)
+			return;
+
+		m_pData = static_cast<const char*>(MapViewOfFile(m_MappingHandle, FILE_MAP_READ, 0, 0, 0));
+		m_IsOpen = m_pData != nullptr;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (m_pData)
+			UnmapViewOfFile(m_pData);
+		if (m_MappingHandle)
+			CloseHandle(m_MappingHandle);
+		if (m_FileHandle)
+			CloseHandle(m_FileHandle);
+	}
+#else
+	MappedFile::MappedFile(const std::string& path)
+	{
+		m_FileDescriptor = open(path.c_str(), O_RDONLY);
+		if (m_FileDescriptor < 0)
+			return;
+
+		struct stat fileStat {};
+		if (fstat(m_FileDescriptor, &fileStat) != 0)
+			return;
+
+		m_Size = static_cast<size_t>(fileStat.st_size);
+		if (m_Size == 0)
+		{
+			m_IsOpen = true;
+			return;
+		}
+
+		void* pData{ mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_FileDescriptor, 0) };
+		if (pData == MAP_FAILED)
+			return;
+
+		madvise(pData, m_Size, MADV_SEQUENTIAL);
+		m_pData = static_cast<const char*>(pData);
+		m_IsOpen = true;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (m_pData)
+			munmap(const_cast<char*>(m_pData), m_Size);
+		if (m_FileDescriptor >= 0)
+			close(m_FileDescriptor);
+	}
+#endif
+#pragma endregion
+
+#pragma region OBJ Parsing
+	namespace
+	{
+		constexpr size_t minOBJChunkSize{ 1 << 20 };
+
+		//What one chunk of lines produced, merged in file order afterwards
+		struct OBJChunk
+		{
+			std::vector<Vector3> positions{};
+			std::vector<int> indices{}; //Triangulated, 0 based
+
+			//Entries of indices that came from negative (relative) OBJ indices, they're relative to the chunk's first vertex
+			//until the vertex count of the preceding chunks is known
+			std::vector<uint32_t> chunkRelativeIndices{};
+
+			bool isValid{ true };
+		};
+
+		bool IsBlank(char character)
+		{
+			return character == ' ' || character == '\t';
+		}
+
+		const char* SkipBlanks(const char* pCurrent, const char* pEnd)
+		{
+			while (pCurrent < pEnd && IsBlank(*pCurrent))
+				++pCurrent;
+			return pCurrent;
+		}
+
+		const char* SkipLine(const char* pCurrent, const char* pEnd)
+		{
+			const void* pNewLine{ memchr(pCurrent, '\n', pEnd - pCurrent) };
+			return pNewLine ? static_cast<const char*>(pNewLine) + 1 : pEnd;
+		}
+
+		bool ParseFloat(const char*& pCurrent, const char* pEnd, float& value)
+		{
+			pCurrent = SkipBlanks(pCurrent, pEnd);
+			if (pCurrent < pEnd && *pCurrent == '+')
+				++pCurrent;
+
+			const auto [pNext, error] { std::from_chars(pCurrent, pEnd, value) };
+			if (error != std::errc{})
+				return false;
+
+			pCurrent = pNext;
+			return true;
+		}
+
+		//"f" line without the "f", only the position index of every v/vt/vn triplet is kept
+		bool ParseFace(const char* pCurrent, const char* pEnd, OBJChunk& chunk, std::vector<int>& faceIndices, std::vector<bool>& faceIsRelative)
+		{
+			faceIndices.clear();
+			faceIsRelative.clear();
+
+			while (true)
+			{
+				pCurrent = SkipBlanks(pCurrent, pEnd);
+				if (pCurrent == pEnd || *pCurrent == '\n' || *pCurrent == '\r' || *pCurrent == '#')
+					break;
+
+				int index{};
+				const auto [pNext, error] { std::from_chars(pCurrent, pEnd, index) };
+				if (error != std::errc{} || index == 0)
+					return false;
+
+				if (index > 0)
+				{
+					faceIndices.push_back(index - 1);
+					faceIsRelative.push_back(false);
+				}
+				else
+				{
+					faceIndices.push_back(static_cast<int>(chunk.positions.size()) + index);
+					faceIsRelative.push_back(true);
+				}
+
+				//Skip the /vt/vn part
+				pCurrent = pNext;
+				while (pCurrent < pEnd && !IsBlank(*pCurrent) && *pCurrent != '\n' && *pCurrent != '\r')
+					++pCurrent;
+			}
+
+			if (faceIndices.size() < 3)
+				return false;
+
+			//Fan around the first vertex
+			for (size_t corner{ 1 }; corner + 1 < faceIndices.size(); ++corner)
+			{
+				for (const size_t faceIdx : { size_t{ 0 }, corner, corner + 1 })
+				{
+					if (faceIsRelative[faceIdx])
+						chunk.chunkRelativeIndices.push_back(static_cast<uint32_t>(chunk.indices.size()));
+					chunk.indices.push_back(faceIndices[faceIdx]);
+				}
+			}
+
+			return true;
+		}
+
+		void ParseChunk(const char* pCurrent, const char* pEnd, OBJChunk& chunk)
+		{
+			std::vector<int> faceIndices{};
+			std::vector<bool> faceIsRelative{};
+
+			while (pCurrent < pEnd && chunk.isValid)
+			{
+				pCurrent = SkipBlanks(pCurrent, pEnd);
+
+				if (pEnd - pCurrent > 1 && IsBlank(pCurrent[1]))
+				{
+					if (pCurrent[0] == 'v')
+					{
+						const char* pValue{ pCurrent + 1 };
+						Vector3 position{};
+						chunk.isValid = ParseFloat(pValue, pEnd, position.x) && ParseFloat(pValue, pEnd, position.y) && ParseFloat(pValue, pEnd, position.z);
+						chunk.positions.push_back(position);
+					}
+					else if (pCurrent[0] == 'f')
+					{
+						chunk.isValid = ParseFace(pCurrent + 1, pEnd, chunk, faceIndices, faceIsRelative);
+					}
+				}
+
+				//Comments, vt, vn, groups, materials, ...
+				pCurrent = SkipLine(pCurrent, pEnd);
+			}
+		}
+
+		//Runs chunkFunc(chunkIdx) for every chunk concurrently, the calling thread takes the first one
+		template<typename ChunkFunc>
+		void RunPerChunk(size_t chunkCount, ChunkFunc&& chunkFunc)
+		{
+			std::vector<std::future<void>> chunkTasks{};
+			chunkTasks.reserve(chunkCount);
+
+			for (size_t chunkIdx{ 1 }; chunkIdx < chunkCount; ++chunkIdx)
+			{
+				chunkTasks.emplace_back(std::async(std::launch::async, [&chunkFunc, chunkIdx]
+					{
+						chunkFunc(chunkIdx);
+					}));
+			}
+
+			chunkFunc(size_t{ 0 });
+
+			for (auto& chunkTask : chunkTasks)
+			{
+				chunkTask.wait();
+			}
+		}
+
+		bool ParseOBJData(const char* pData, size_t size, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices)
+		{
+			const size_t chunkCount{ std::clamp<size_t>(size / minOBJChunkSize, 1, std::max(1u, std::thread::hardware_concurrency())) };
+
+			//Chunk boundaries are moved forward to the next line start, so every line belongs to exactly one chunk
+			std::vector<const char*> chunkStarts(chunkCount + 1, pData + size);
+			chunkStarts[0] = pData;
+			for (size_t chunkIdx{ 1 }; chunkIdx < chunkCount; ++chunkIdx)
+			{
+				const char* pSplit{ std::max(pData + size * chunkIdx / chunkCount, chunkStarts[chunkIdx - 1]) };
+				chunkStarts[chunkIdx] = SkipLine(pSplit - 1, pData + size);
+			}
+
+			std::vector<OBJChunk> chunks(chunkCount);
+			RunPerChunk(chunkCount, [&chunks, &chunkStarts](size_t chunkIdx)
+				{
+					ParseChunk(chunkStarts[chunkIdx], chunkStarts[chunkIdx + 1], chunks[chunkIdx]);
+				});
+
+			//On failure the outputs are emptied, so a caller never sees a partial mesh with out of range indices
+			const auto fail = [&positions, &normals, &indices]
+			{
+				positions.clear();
+				normals.clear();
+				indices.clear();
+				return false;
+			};
+
+			//Offsets of every chunk in the merged buffers
+			std::vector<size_t> positionOffsets(chunkCount + 1);
+			std::vector<size_t> indexOffsets(chunkCount + 1);
+			for (size_t chunkIdx{}; chunkIdx < chunkCount; ++chunkIdx)
+			{
+				if (!chunks[chunkIdx].isValid)
+					return fail();
+
+				positionOffsets[chunkIdx + 1] = positionOffsets[chunkIdx] + chunks[chunkIdx].positions.size();
+				indexOffsets[chunkIdx + 1] = indexOffsets[chunkIdx] + chunks[chunkIdx].indices.size();
+			}
+
+			const size_t positionCount{ positionOffsets[chunkCount] };
+			const size_t triangleCount{ indexOffsets[chunkCount] / 3 };
+
+			//Indices are resolved and checked in the chunks, before anything is written to the outputs
+			//A face can reference vertices of any earlier chunk, so only the total vertex count bounds them
+			std::vector<uint8_t> chunkIsValid(chunkCount);
+			RunPerChunk(chunkCount, [&](size_t chunkIdx)
+				{
+					OBJChunk& chunk{ chunks[chunkIdx] };
+
+					for (const uint32_t relativeIdx : chunk.chunkRelativeIndices)
+					{
+						chunk.indices[relativeIdx] += static_cast<int>(positionOffsets[chunkIdx]);
+					}
+
+					const auto [minIdx, maxIdx] = std::minmax_element(chunk.indices.begin(), chunk.indices.end());
+					chunkIsValid[chunkIdx] = chunk.indices.empty() || (*minIdx >= 0 && static_cast<size_t>(*maxIdx) < positionCount);
+				});
+
+			if (!std::all_of(chunkIsValid.begin(), chunkIsValid.end(), [](uint8_t isValid) { return isValid != 0; }))
+				return fail();
+
+			positions.resize(positionCount);
+			indices.resize(indexOffsets[chunkCount]);
+			normals.resize(triangleCount);
+
+			//Faces never straddle a chunk, so every chunk holds whole triangles
+			RunPerChunk(chunkCount, [&](size_t chunkIdx)
+				{
+					const OBJChunk& chunk{ chunks[chunkIdx] };
+					std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + positionOffsets[chunkIdx]);
+					std::copy(chunk.indices.begin(), chunk.indices.end(), indices.begin() + indexOffsets[chunkIdx]);
+				});
+
+			//Separate pass, the normals need the merged positions
+			RunPerChunk(chunkCount, [&](size_t chunkIdx)
+				{
+					for (size_t index{ indexOffsets[chunkIdx] }; index < indexOffsets[chunkIdx + 1]; index += 3)
+					{
+						const Vector3 edgeV0V1{ positions[indices[index + 1]] - positions[indices[index]] };
+						const Vector3 edgeV0V2{ positions[indices[index + 2]] - positions[indices[index]] };
+						normals[index / 3] = Vector3::Cross(edgeV0V1, edgeV0V2).Normalized();
+					}
+				});
+
+			return true;
+		}
+#pragma endregion
+
+#pragma region Mesh Cache
+		//Binary image of a loaded mesh: header followed by the arrays, every array starting on a 16 byte boundary
+		struct MeshCacheHeader
+		{
+			static constexpr char expectedMagic[8]{ 'D', 'A', 'E', 'M', 'E', 'S', 'H', '\0' };
+			static constexpr uint32_t expectedVersion{ 1 };
+			static constexpr uint32_t noBVH{ UINT32_MAX };
+
+			char magic[8]{};
+			uint32_t version{};
+			uint32_t bvhBuilder{ noBVH }; //BVHBuilder the stored hierarchy was built with
+
+			//Identify the source OBJ by content, not by path or timestamp
+			uint64_t sourceHash{};
+			uint64_t sourceSize{};
+
+			uint64_t positionCount{};
+			uint64_t normalCount{};
+			uint64_t indexCount{};
+			uint64_t bvhNodeCount{};
+			uint64_t bvhPrimitiveIndexCount{};
+
+			Vector3 minAABB{};
+			Vector3 maxAABB{};
+		};
+
+		static_assert(sizeof(Vector3) == 3 * sizeof(float) && std::is_trivially_copyable_v<Vector3>);
+		static_assert(std::is_trivially_copyable_v<BVHNode> && std::is_trivially_copyable_v<MeshCacheHeader>);
+
+		constexpr size_t meshCacheAlignment{ 16 };
+
+		size_t AlignCacheOffset(size_t offset)
+		{
+			return (offset + meshCacheAlignment - 1) & ~(meshCacheAlignment - 1);
+		}
+
+		//Byte offsets of the arrays in the file, the last entry is the file size
+		std::array<size_t, 6> GetMeshCacheLayout(const MeshCacheHeader& header)
+		{
+			std::array<size_t, 6> offsets{};
+			offsets[0] = AlignCacheOffset(sizeof(MeshCacheHeader));
+			offsets[1] = AlignCacheOffset(offsets[0] + header.positionCount * sizeof(Vector3));
+			offsets[2] = AlignCacheOffset(offsets[1] + header.normalCount * sizeof(Vector3));
+			offsets[3] = AlignCacheOffset(offsets[2] + header.indexCount * sizeof(int));
+			offsets[4] = AlignCacheOffset(offsets[3] + header.bvhNodeCount * sizeof(BVHNode));
+			offsets[5] = offsets[4] + header.bvhPrimitiveIndexCount * sizeof(uint32_t);
+			return offsets;
+		}
+
+		//Multiply-xor over 8 byte words, runs at memory speed so hashing a large OBJ costs far less than parsing it
+		uint64_t HashContent(const char* pData, size_t size)
+		{
+			constexpr uint64_t multiplier{ 0x9E3779B97F4A7C15ull };
+			uint64_t hash{ size * multiplier };
+
+			size_t offset{};
+			for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t))
+			{
+				uint64_t word{};
+				memcpy(&word, pData + offset, sizeof(uint64_t));
+				hash = (hash ^ word ^ (hash >> 29)) * multiplier;
+			}
+
+			uint64_t tail{};
+			if (offset < size)
+				memcpy(&tail, pData + offset, size - offset);
+			hash = (hash ^ tail ^ (hash >> 29)) * multiplier;
+
+			return hash ^ (hash >> 32);
+		}
+
+		template<typename T>
+		void CopyCacheArray(const char* pData, size_t offset, uint64_t count, std::vector<T>& values)
+		{
+			values.resize(count);
+			if (count > 0)
+				memcpy(values.data(), pData + offset, count * sizeof(T));
+		}
+
+		//The hash only ties a cache to its OBJ, the payload itself could still be corrupted or come from an older layout
+		//Every index is checked against the arrays it points into, O(n) and far cheaper than a parse
+		bool IsMeshCacheValid(const MeshCacheHeader& header, const std::vector<int>& indices, const std::vector<BVHNode>& nodes, const std::vector<uint32_t>& primitiveIndices)
+		{
+			const uint64_t positionCount{ header.positionCount };
+			const bool areIndicesValid{ std::all_of(indices.begin(), indices.end(),
+				[positionCount](int index) { return index >= 0 && static_cast<uint64_t>(index) < positionCount; }) };
+
+			if (!areIndicesValid)
+				return false;
+
+			if (nodes.empty())
+				return true;
+
+			const uint64_t triangleCount{ header.indexCount / 3 };
+			if (primitiveIndices.size() != triangleCount)
+				return false;
+
+			const bool arePrimitiveIndicesValid{ std::all_of(primitiveIndices.begin(), primitiveIndices.end(),
+				[triangleCount](uint32_t primitiveIdx) { return primitiveIdx < triangleCount; }) };
+
+			if (!arePrimitiveIndicesValid)
+				return false;
+
+			//Every builder places children after their parent, which also rules out cycles
+			for (size_t nodeIdx{}; nodeIdx < nodes.size(); ++nodeIdx)
+			{
+				const BVHNode& node{ nodes[nodeIdx] };
+				const bool isValid{ node.IsLeaf()
+					? static_cast<uint64_t>(node.leftFirst) + node.primitiveCount <= primitiveIndices.size()
+					: node.leftFirst > nodeIdx && static_cast<uint64_t>(node.leftFirst) + 1 < nodes.size() };
+
+				if (!isValid)
+					return false;
+			}
+
+			return true;
+		}
+
+		bool ReadMeshCache(const std::string& cachePath, uint64_t sourceHash, uint64_t sourceSize, TriangleMesh& mesh)
+		{
+			const MappedFile file{ cachePath };
+			if (!file.IsOpen() || file.GetSize() < sizeof(MeshCacheHeader))
+				return false;
+
+			MeshCacheHeader header{};
+			memcpy(&header, file.GetData(), sizeof(MeshCacheHeader));
+
+			if (memcmp(header.magic, MeshCacheHeader::expectedMagic, sizeof(header.magic)) != 0 || header.version != MeshCacheHeader::expectedVersion
+				|| header.sourceHash != sourceHash || header.sourceSize != sourceSize)
+				return false;
+
+			//Also rejects a file that was cut short while being written
+			const std::array<size_t, 6> offsets{ GetMeshCacheLayout(header) };
+			if (offsets[5] != file.GetSize() || header.normalCount * 3 != header.indexCount)
+				return false;
+
+			//A hierarchy from another builder (or none at all) is rebuilt by the next UpdateTransforms
+			const bool useBVH{ mesh.bvhOn && header.bvhNodeCount > 0 && header.bvhBuilder == static_cast<uint32_t>(mesh.bvh.GetBuilder()) };
+
+			//Read and checked before anything is written to the mesh, a rejected cache falls back to parsing the OBJ
+			const char* pData{ file.GetData() };
+			std::vector<int> indices{};
+			std::vector<BVHNode> nodes{};
+			std::vector<uint32_t> primitiveIndices{};
+			CopyCacheArray(pData, offsets[2], header.indexCount, indices);
+			if (useBVH)
+			{
+				CopyCacheArray(pData, offsets[3], header.bvhNodeCount, nodes);
+				CopyCacheArray(pData, offsets[4], header.bvhPrimitiveIndexCount, primitiveIndices);
+			}
+
+			if (!IsMeshCacheValid(header, indices, nodes, primitiveIndices))
+				return false;
+
+			CopyCacheArray(pData, offsets[0], header.positionCount, mesh.positions);
+			CopyCacheArray(pData, offsets[1], header.normalCount, mesh.normals);
+			mesh.indices = std::move(indices);
+			mesh.minAABB = header.minAABB;
+			mesh.maxAABB = header.maxAABB;
+
+			if (useBVH)
+				mesh.bvh.Load(std::move(nodes), std::move(primitiveIndices));
+			else
+				mesh.bvh.Clear();
+
+			mesh.topologyDirty = mesh.bvhOn && !useBVH;
+			mesh.positionsDirty = false;
+			return true;
+		}
+
+		template<typename T>
+		void WriteCacheArray(std::ofstream& file, size_t offset, const std::vector<T>& values)
+		{
+			const size_t padding{ offset - static_cast<size_t>(file.tellp()) };
+			const char zeros[meshCacheAlignment]{};
+			file.write(zeros, padding);
+			file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+		}
+
+		//Written to a temporary file first, so a concurrent load of the same mesh never sees a partial cache
+		bool WriteMeshCache(const std::string& cachePath, uint64_t sourceHash, uint64_t sourceSize, const TriangleMesh& mesh)
+		{
+			const bool hasBVH{ mesh.bvhOn && !mesh.bvh.IsEmpty() };
+			const std::vector<BVHNode> noNodes{};
+			const std::vector<uint32_t> noPrimitiveIndices{};
+
+			MeshCacheHeader header{};
+			memcpy(header.magic, MeshCacheHeader::expectedMagic, sizeof(header.magic));
+			header.version = MeshCacheHeader::expectedVersion;
+			header.bvhBuilder = hasBVH ? static_cast<uint32_t>(mesh.bvh.GetBuilder()) : MeshCacheHeader::noBVH;
+			header.sourceHash = sourceHash;
+			header.sourceSize = sourceSize;
+			header.positionCount = mesh.positions.size();
+			header.normalCount = mesh.normals.size();
+			header.indexCount = mesh.indices.size();
+			header.bvhNodeCount = hasBVH ? mesh.bvh.GetNodes().size() : 0;
+			header.bvhPrimitiveIndexCount = hasBVH ? mesh.bvh.GetPrimitiveIndices().size() : 0;
+			header.minAABB = mesh.minAABB;
+			header.maxAABB = mesh.maxAABB;
+
+			const std::array<size_t, 6> offsets{ GetMeshCacheLayout(header) };
+			const std::string tempPath{ cachePath + ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) };
+
+			{
+				std::ofstream file{ tempPath, std::ios::binary | std::ios::trunc };
+				if (!file)
+					return false;
+
+				file.write(reinterpret_cast<const char*>(&header), sizeof(MeshCacheHeader));
+				WriteCacheArray(file, offsets[0], mesh.positions);
+				WriteCacheArray(file, offsets[1], mesh.normals);
+				WriteCacheArray(file, offsets[2], mesh.indices);
+				WriteCacheArray(file, offsets[3], hasBVH ? mesh.bvh.GetNodes() : noNodes);
+				WriteCacheArray(file, offsets[4], hasBVH ? mesh.bvh.GetPrimitiveIndices() : noPrimitiveIndices);
+
+				if (!file)
+				{
+					file.close();
+					std::filesystem::remove(tempPath);
+					return false;
+				}
+			}
+
+			std::error_code error{};
+			std::filesystem::rename(tempPath, cachePath, error);
+			if (error)
+				std::filesystem::remove(tempPath, error);
+
+			return !error;
+		}
+#pragma endregion
+	}
+
+#pragma region Mesh Loading
+	bool Utils::ParseOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices)
+	{
+		const MappedFile file{ filename };
+		if (!file.IsOpen())
+		{
+			positions.clear();
+			normals.clear();
+			indices.clear();
+			return false;
+		}
+
+		return ParseOBJData(file.GetData(), file.GetSize(), positions, normals, indices);
+	}
+
+	bool Utils::LoadMesh(const std::string& filename, TriangleMesh& mesh)
+	{
+		const MappedFile file{ filename };
+		if (!file.IsOpen())
+			return false;
+
+		const uint64_t sourceHash{ HashContent(file.GetData(), file.GetSize()) };
+		const std::string cachePath{ filename + ".meshcache" };
+
+		if (!ReadMeshCache(cachePath, sourceHash, file.GetSize(), mesh))
+		{
+			if (!ParseOBJData(file.GetData(), file.GetSize(), mesh.positions, mesh.normals, mesh.indices))
+				return false;
+
+			mesh.UpdateAABB();
+			if (mesh.bvhOn)
+				mesh.bvh.Build(mesh.positions, mesh.indices);
+			else
+				mesh.bvh.Clear();
+
+			mesh.topologyDirty = false;
+			mesh.positionsDirty = false;
+
+			//A read-only location only costs the speedup, the mesh itself is fine
+			WriteMeshCache(cachePath, sourceHash, file.GetSize(), mesh);
+		}
+
+		if (!mesh.topologyDirty)
+		{
+			mesh.UpdateTriangleData();
+			++mesh.geometryVersion;
+		}
+
+		return true;
+	}
+#pragma endregion
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "DataTypes.h"
+#include "Math.h"
+
+namespace dae
+{
+	//Read-only view of a whole file, the OS pages it in on demand
+	class MappedFile final
+	{
+	public:
+		explicit MappedFile(const std::string& path);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile(MappedFile&&) noexcept = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile& operator=(MappedFile&&) noexcept = delete;
+
+		bool IsOpen() const { return m_IsOpen; }
+		const char* GetData() const { return m_pData; }
+		size_t GetSize() const { return m_Size; }
+
+	private:
+		const char* m_pData{}; //nullptr for an empty file
+		size_t m_Size{};
+		bool m_IsOpen{};
+
+#if defined(_WIN32)
+		void* m_FileHandle{};
+		void* m_MappingHandle{};
+#else
+		int m_FileDescriptor{ -1 };
+#endif
+	};
+
+	namespace Utils
+	{
+		/**
+		 * \brief Parses the positions and faces of a Wavefront OBJ, the file is memory mapped and split in line aligned chunks parsed concurrently
+		 * Faces accept every index syntax (v, v/vt, v//vn, v/vt/vn, negative = relative), polygons are triangulated as fans
+		 * vt/vn data isn't kept, normals are computed per triangle like the TriangleMesh expects
+		 * \param positions, normals, indices are overwritten, and emptied when the parse fails
+		 * \return false when the file can't be opened, a vertex is malformed or a face references a vertex that doesn't exist
+		 */
+		bool ParseOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices);
+
+		/**
+		 * \brief Fills the positions, normals, indices, object space AABB and BVH of a mesh from an OBJ, through a binary cache next to it
+		 * <filename>.meshcache is used when it was written for the same OBJ content, otherwise the OBJ is parsed, the BVH built and the cache (re)written
+		 * The stored BVH is only taken over when the mesh uses the same builder, transforms are left alone (call UpdateTransforms afterwards as usual)
+		 * \return false when the OBJ can't be opened or parsed
+		 */
+		bool LoadMesh(const std::string& filename, TriangleMesh& mesh);
+	}
+}
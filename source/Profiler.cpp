@@ -0,0 +1,105 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+namespace dae {
+
+	Profiler& Profiler::Get()
+	{
+		static Profiler profiler{};
+		return profiler;
+	}
+
+	void Profiler::StartCapture(ProfileLevel level)
+	{
+		{
+			std::lock_guard lock{ m_Mutex };
+			for (const std::unique_ptr<ThreadBuffer>& pBuffer : m_ThreadBuffers)
+			{
+				pBuffer->writeCount = 0;
+			}
+		}
+
+		m_CaptureStartNs = GetTimeNs();
+		s_CaptureState.store(static_cast<int>(level) + 1, std::memory_order_relaxed);
+	}
+
+	void Profiler::StopCapture()
+	{
+		s_CaptureState.store(0, std::memory_order_relaxed);
+	}
+
+	void Profiler::Record(const char* name, uint64_t startNs, uint64_t endNs)
+	{
+		ThreadBuffer& buffer{ GetThreadBuffer() };
+		buffer.events[buffer.writeCount % eventsPerThread] = ProfileEvent{ name, startNs, endNs };
+		++buffer.writeCount;
+	}
+
+	bool Profiler::WriteChromeTrace(const std::string& path) const
+	{
+		std::ofstream file{ path };
+		if (!file)
+			return false;
+
+		std::lock_guard lock{ m_Mutex };
+
+		file << std::fixed << std::setprecision(3);
+
+		//Complete ("X") events with microsecond timestamps relative to the capture start, one track per thread
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+		bool isFirstEvent{ true };
+		for (const std::unique_ptr<ThreadBuffer>& pBuffer : m_ThreadBuffers)
+		{
+			file << (isFirstEvent ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << pBuffer->threadIdx
+				<< ",\"args\":{\"name\":\"Thread " << pBuffer->threadIdx << "\"}}";
+			isFirstEvent = false;
+
+			const uint64_t firstEvent{ pBuffer->writeCount > eventsPerThread ? pBuffer->writeCount - eventsPerThread : 0 };
+
+			for (uint64_t i{ firstEvent }; i < pBuffer->writeCount; ++i)
+			{
+				const ProfileEvent& event{ pBuffer->events[i % eventsPerThread] };
+				if (event.startNs < m_CaptureStartNs)
+					continue;
+
+				file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << pBuffer->threadIdx
+					<< ",\"ts\":" << (event.startNs - m_CaptureStartNs) / 1000.0
+					<< ",\"dur\":" << (event.endNs - event.startNs) / 1000.0 << "}";
+			}
+		}
+
+		file << "\n]}\n";
+		return static_cast<bool>(file);
+	}
+
+	uint64_t Profiler::GetTimeNs()
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	Profiler::ThreadBuffer& Profiler::GetThreadBuffer()
+	{
+		thread_local ThreadBuffer* pThreadBuffer{};
+
+		if (!pThreadBuffer)
+		{
+			//Buffers are owned by the profiler and outlive their thread, so the trace can be written after the thread exits
+			std::lock_guard lock{ m_Mutex };
+
+			auto pBuffer{ std::make_unique<ThreadBuffer>() };
+			pBuffer->threadIdx = static_cast<uint32_t>(m_ThreadBuffers.size());
+			pBuffer->events.resize(eventsPerThread);
+
+			pThreadBuffer = pBuffer.get();
+			m_ThreadBuffers.push_back(std::move(pBuffer));
+		}
+
+		return *pThreadBuffer;
+	}
+}
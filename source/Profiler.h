@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//Comment out to compile every PROFILE_ZONE away
+#define PROFILER_ENABLED
+
+namespace dae
+{
+	enum class ProfileLevel : uint8_t
+	{
+		Coarse, //Frame, scene update, render, tiles, present: a handful of zones per tile
+		Detailed //+ per pixel stages (primary hit, shadow rays, shading, pixel write), several zones per pixel
+	};
+
+	struct ProfileEvent
+	{
+		const char* name{}; //String literal, only the pointer is stored
+		uint64_t startNs{};
+		uint64_t endNs{};
+	};
+
+	//Collects scoped zones into one ring buffer per thread while capturing, exports them as a chrome://tracing / Perfetto JSON
+	//StartCapture, StopCapture and WriteChromeTrace must be called between frames, while no other thread records zones
+	class Profiler final
+	{
+	public:
+		static Profiler& Get();
+
+		Profiler(const Profiler&) = delete;
+		Profiler(Profiler&&) noexcept = delete;
+		Profiler& operator=(const Profiler&) = delete;
+		Profiler& operator=(Profiler&&) noexcept = delete;
+
+		//Clears the previous capture
+		void StartCapture(ProfileLevel level = ProfileLevel::Coarse);
+		void StopCapture();
+		static bool IsCapturing(ProfileLevel level) { return s_CaptureState.load(std::memory_order_relaxed) > static_cast<int>(level); }
+
+		void Record(const char* name, uint64_t startNs, uint64_t endNs);
+		bool WriteChromeTrace(const std::string& path) const;
+
+		static uint64_t GetTimeNs();
+
+	private:
+		Profiler() = default;
+		~Profiler() = default;
+
+		//Written by its thread only, the oldest events get overwritten once full
+		struct ThreadBuffer
+		{
+			uint32_t threadIdx{};
+			std::vector<ProfileEvent> events{};
+			uint64_t writeCount{};
+		};
+
+		static constexpr size_t eventsPerThread{ 1 << 18 };
+
+		static inline std::atomic<int> s_CaptureState{}; //0: off, otherwise ProfileLevel + 1
+
+		mutable std::mutex m_Mutex{}; //Guards m_ThreadBuffers, taken once per thread on its first zone
+		std::vector<std::unique_ptr<ThreadBuffer>> m_ThreadBuffers{};
+		uint64_t m_CaptureStartNs{};
+
+		ThreadBuffer& GetThreadBuffer();
+	};
+
+	//Records the lifetime of its scope when the profiler captures at level or above, costs one relaxed load otherwise
+	class ProfileZone final
+	{
+	public:
+		ProfileZone(const char* name, ProfileLevel level)
+			: m_Name{ Profiler::IsCapturing(level) ? name : nullptr }
+			, m_StartNs{ m_Name ? Profiler::GetTimeNs() : 0 }
+		{
+		}
+
+		~ProfileZone()
+		{
+			if (m_Name)
+				Profiler::Get().Record(m_Name, m_StartNs, Profiler::GetTimeNs());
+		}
+
+		ProfileZone(const ProfileZone&) = delete;
+		ProfileZone(ProfileZone&&) noexcept = delete;
+		ProfileZone& operator=(const ProfileZone&) = delete;
+		ProfileZone& operator=(ProfileZone&&) noexcept = delete;
+
+	private:
+		const char* m_Name;
+		uint64_t m_StartNs;
+	};
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if defined(PROFILER_ENABLED)
+#define PROFILE_ZONE(name) const dae::ProfileZone PROFILE_CONCAT(profileZone, __LINE__){ name, dae::ProfileLevel::Coarse }
+#define PROFILE_ZONE_DETAILED(name) const dae::ProfileZone PROFILE_CONCAT(profileZone, __LINE__){ name, dae::ProfileLevel::Detailed }
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_ZONE_DETAILED(name)
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+
+//Comment out to compile the intersection counters away
+#define RAY_STATS_ENABLED
+
+namespace dae
+{
+	//Intersection work, the GeometryUtils tests count into the calling thread's instance (see GetThreadStats)
+	//Packet tests count once per lane, a 4-wide BVH node test once per child box
+	struct RayStats
+	{
+		uint64_t rays{}; //Primary + shadow rays, filled in by the Renderer
+		uint64_t boxTests{}; //BVH nodes and mesh bounds
+		uint64_t triangleTests{};
+		uint64_t primitiveTests{}; //Spheres and planes
+
+		uint64_t GetTestCount() const { return boxTests + triangleTests + primitiveTests; }
+
+		RayStats& operator+=(const RayStats& other)
+		{
+			rays += other.rays;
+			boxTests += other.boxTests;
+			triangleTests += other.triangleTests;
+			primitiveTests += other.primitiveTests;
+			return *this;
+		}
+
+		RayStats operator-(const RayStats& other) const
+		{
+			return RayStats{ rays - other.rays, boxTests - other.boxTests, triangleTests - other.triangleTests, primitiveTests - other.primitiveTests };
+		}
+
+		//Only ever grows, callers take the difference between two snapshots to measure a piece of work
+		static RayStats& GetThreadStats()
+		{
+			thread_local RayStats stats{};
+			return stats;
+		}
+	};
+}
+
+#if defined(RAY_STATS_ENABLED)
+#define RAY_STATS_ADD(counter, count) (dae::RayStats::GetThreadStats().counter += (count))
+#else
+#define RAY_STATS_ADD(counter, count)
+#endif
@@ -9,17 +9,54 @@
 #include "Material.h"
 #include "Scene.h"
 #include "Utils.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
 
-#include <ppl.h>
-#include <future>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <emmintrin.h>
 #include <iostream>
 
 using namespace dae;
 
 
 
-//#define ASYNC
-#define PARALLEL_FOR
+#define THREAD_POOL
+//#define PARALLEL_FOR //MSVC only, hands the tiles to PPL instead of the thread pool
+
+#if defined(PARALLEL_FOR)
+#include <ppl.h>
+#endif
+
+namespace
+{
+	constexpr int gammaLutSize{ 4096 };
+
+	//PCG output permutation, decorrelates consecutive inputs well enough for sampling
+	uint32_t HashPCG(uint32_t value)
+	{
+		const uint32_t state = value * 747796405u + 2891336453u;
+		const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	//Linear [0, 1] quantized to 12 bits -> 8 bit gamma 2.2, pow has no SSE counterpart so the resolve looks it up
+	const std::array<uint8_t, gammaLutSize>& GetGammaLut()
+	{
+		static const std::array<uint8_t, gammaLutSize> gammaLut = []
+		{
+			std::array<uint8_t, gammaLutSize> lut{};
+			for (int i = 0; i < gammaLutSize; ++i)
+			{
+				lut[i] = static_cast<uint8_t>(std::pow(i / float(gammaLutSize - 1), 1.f / 2.2f) * 255.f + .5f);
+			}
+			return lut;
+		}();
+
+		return gammaLut;
+	}
+}
 
 
 
@@ -29,73 +66,132 @@ Renderer::Renderer(SDL_Window * pWindow) :
 {
 	//Initialize
 	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
-	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
+	AllocateBuffers();
+
+#if defined(THREAD_POOL)
+	m_pThreadPool = std::make_unique<ThreadPool>();
+#endif
+}
+
+Renderer::Renderer(int width, int height) :
+	m_Width(width),
+	m_Height(height)
+{
+	AllocateBuffers();
+
+#if defined(THREAD_POOL)
+	m_pThreadPool = std::make_unique<ThreadPool>();
+#endif
 }
 
-void Renderer::Render(Scene* pScene) const
+Renderer::~Renderer() = default;
+
+void Renderer::AllocateBuffers()
+{
+	const size_t pixelCount = static_cast<size_t>(m_Width) * m_Height;
+	m_Pixels.resize(pixelCount);
+
+	//Planes padded to 16 floats, so all three start on a cache line
+	m_AccumulationPlaneSize = (pixelCount + 15) & ~size_t{ 15 };
+	m_Accumulation.assign(m_AccumulationPlaneSize * 3, 0.f);
+	m_pAccumulation = m_Accumulation.data();
+}
+
+void Renderer::Render(Scene* pScene)
 {
-	
+	PROFILE_ZONE("Renderer::Render");
 
 	Camera& camera = pScene->GetCamera();
 	camera.CalculateCameraToWorld();
+
+	//Objects may have moved during Scene::Update
+	{
+		PROFILE_ZONE("Scene::UpdateSceneBVH");
+		pScene->UpdateSceneBVH();
+	}
 	//camera.SetFovAngle(60.f);
 
 
 	float aspectRatio = static_cast<float>(m_Width) / static_cast<float>(m_Height);
 
-	auto& materials = pScene->GetMaterials();
-	auto& lights = pScene->GetLights();
+	//Progressive: as long as the image can't change, this frame's samples are averaged into the previous ones
+	const bool isImageUnchanged = m_ProgressiveEnabled
+		&& pScene == m_pAccumulatedScene
+		&& pScene->GetVersion() == m_AccumulatedSceneVersion
+		&& camera.cameraToWorld == m_AccumulatedCameraToWorld
+		&& camera.fovAngle == m_AccumulatedFovAngle;
+
+	if (!isImageUnchanged)
+	{
+		m_SampleCount = 0;
+		m_pAccumulatedScene = pScene;
+		m_AccumulatedSceneVersion = pScene->GetVersion();
+		m_AccumulatedCameraToWorld = camera.cameraToWorld;
+		m_AccumulatedFovAngle = camera.fovAngle;
+	}
 
-	const uint32_t numPixels = m_Width * m_Height;
+	//Converged: keep presenting the accumulated image without tracing anything
+	const bool isConverged = m_SampleCount >= maxProgressiveSamples;
 
+	//The first sample is centered so a single frame matches the non progressive image
+	m_JitterX = m_SampleCount ? GetHalton(m_SampleCount, 2) : .5f;
+	m_JitterY = m_SampleCount ? GetHalton(m_SampleCount, 3) : .5f;
+	m_SampleWeight = 1.f / (m_SampleCount + 1);
 
-#if defined(ASYNC)
+	auto& materials = pScene->GetMaterials();
+	auto& lights = pScene->GetLights();
 
+	//Lights or the cutoff may have changed since the last frame, recomputing is cheap next to tracing
+	m_LightRangesSqr.resize(lights.size());
+	m_HasLimitedLights = false;
+	for (size_t i = 0; i < lights.size(); ++i)
+	{
+		const float range = LightUtils::GetRange(lights[i], m_LightCutoff);
+		m_LightRangesSqr[i] = range == FLT_MAX ? FLT_MAX : range * range;
+		m_HasLimitedLights |= range != FLT_MAX;
+	}
 
-	//----------------- Async --------------------------------------
-	//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-	const uint32_t numCores = std::thread::hardware_concurrency();
-	std::vector<std::future<void>> async_futures{};
-	const uint32_t numPixelsPerTask = numPixels / numCores;
-	uint32_t numUnassignedPixels = numPixels % numCores;
-	uint32_t currPixelIndex = 0;
+	//A tile is the unit of work handed to a thread: big enough to amortize scheduling,
+	//and no two threads write pixels of the same cache line except along tile borders
+	m_TilesPerRow = (m_Width + m_TileSize - 1) / m_TileSize;
+	const uint32_t numTiles = isConverged ? 0 : m_TilesPerRow * ((m_Height + m_TileSize - 1) / m_TileSize);
+	m_TileTimesMs.resize(numTiles);
+	m_TileRayStats.resize(numTiles);
+	m_TileLightCounts.resize(numTiles);
 
-	for (uint32_t coreId{0}; coreId < numCores ; ++coreId)
+	//By reference: every tile is done before Render returns, copying would duplicate the light and material vectors and the camera each frame
+	const auto renderTile = [&, this](uint32_t tileIndex)
 	{
-		uint32_t taskSize = numPixelsPerTask;
-		if (numUnassignedPixels > 0)
-		{
-			++taskSize;
-			--numUnassignedPixels;
-		}
+		PROFILE_ZONE("Renderer::RenderTile");
+		const auto start = std::chrono::high_resolution_clock::now();
 
-		async_futures.emplace_back(std::async(std::launch::async, [=, this]
-			{
-				//Render all pixels for this task (currPixelIndex > currPixelIndex + taskSize)
-				const uint32_t pixelIndexEnd = currPixelIndex + taskSize;
-				for (uint32_t pixelIndex{ currPixelIndex }; pixelIndex < pixelIndexEnd; ++pixelIndex)
-				{
-					RenderPixel(pScene, pixelIndex, aspectRatio, camera, lights, materials);
-				}
+		const RayStats statsBefore = RayStats::GetThreadStats();
+		const uint32_t rayCount = RenderTile(pScene, tileIndex, aspectRatio, camera, lights, materials, m_TileLightCounts[tileIndex]);
 
-			}));
+		m_TileRayStats[tileIndex] = RayStats::GetThreadStats() - statsBefore;
+		m_TileRayStats[tileIndex].rays = rayCount;
 
-		currPixelIndex += taskSize;
-	}
+		const std::chrono::duration<float, std::milli> duration = std::chrono::high_resolution_clock::now() - start;
+		m_TileTimesMs[tileIndex] = duration.count();
+	};
 
+	const auto traceStart = std::chrono::high_resolution_clock::now();
 
-	//Wait for async completion of all tasks
-	for (const std::future<void>& f : async_futures)
-	{
-		f.wait();
-	}
+
+#if defined(THREAD_POOL)
+
+	//----------------- Thread Pool ----------------------------
+	//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+	m_pThreadPool->ParallelFor(numTiles, [&](uint32_t tileIndex, uint32_t) {
+		renderTile(tileIndex);
+		});
 
 #elif defined(PARALLEL_FOR)
 
 	//----------------- Parallel For ---------------------------
 	//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-	concurrency::parallel_for(0u, numPixels, [=, this](int i) {
-		RenderPixel(pScene, i, aspectRatio, camera, lights, materials);
+	concurrency::parallel_for(0u, numTiles, [=](int i) {
+		renderTile(i);
 		});
 
 
@@ -103,26 +199,228 @@ void Renderer::Render(Scene* pScene) const
 
 	//----------------- No Threading ---------------------------
 	//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-	for (uint32_t i = 0; i < numPixels; ++i)
+	for (uint32_t i = 0; i < numTiles; ++i)
 	{
-		RenderPixel(pScene, i, aspectRatio, camera, lights, materials);
+		renderTile(i);
 	}
 
 #endif
 
 
+	const std::chrono::duration<float, std::milli> traceDuration = std::chrono::high_resolution_clock::now() - traceStart;
+	m_FrameTraceMs = traceDuration.count();
+
+	m_FrameRayStats = RayStats{};
+	for (const RayStats& tileRayStats : m_TileRayStats)
+	{
+		m_FrameRayStats += tileRayStats;
+	}
+
+	uint64_t tileLightTotal{};
+	for (const uint32_t tileLightCount : m_TileLightCounts)
+	{
+		tileLightTotal += tileLightCount;
+	}
+	m_FrameLightsPerTile = numTiles ? static_cast<float>(tileLightTotal) / numTiles : 0.f;
+
+	if (!isConverged && m_ProgressiveEnabled)
+		++m_SampleCount;
+
+	//Tracing only wrote linear colors, quantizing them is a pass of its own
+	{
+		PROFILE_ZONE("Renderer::Resolve");
+
+		const uint32_t pixelCount = static_cast<uint32_t>(m_Width * m_Height);
+		const uint32_t numResolveTasks = (pixelCount + resolvePixelsPerTask - 1) / resolvePixelsPerTask;
+
+#if defined(THREAD_POOL)
+		m_pThreadPool->ParallelFor(numResolveTasks, [&](uint32_t taskIndex, uint32_t) {
+			ResolvePixels(taskIndex * resolvePixelsPerTask, std::min((taskIndex + 1) * resolvePixelsPerTask, pixelCount));
+			});
+#else
+		for (uint32_t i = 0; i < numResolveTasks; ++i)
+		{
+			ResolvePixels(i * resolvePixelsPerTask, std::min((i + 1) * resolvePixelsPerTask, pixelCount));
+		}
+#endif
+	}
+
 	//@END
 	//Update SDL Surface
-	SDL_UpdateWindowSurface(m_pWindow);
+	if (m_pWindow)
+	{
+		//The window surface format is up to the platform, SDL converts while copying
+		{
+			PROFILE_ZONE("SDL_ConvertPixels");
+			SDL_ConvertPixels(m_Width, m_Height, SDL_PIXELFORMAT_ARGB8888, m_Pixels.data(), m_Width * static_cast<int>(sizeof(uint32_t)),
+				m_pBuffer->format->format, m_pBuffer->pixels, m_pBuffer->pitch);
+		}
+
+		PROFILE_ZONE("SDL_UpdateWindowSurface");
+		SDL_UpdateWindowSurface(m_pWindow);
+	}
+}
+
+uint32_t dae::Renderer::RenderTile(Scene* pScene, uint32_t tileIndex, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials,
+	uint32_t& tileLightCount) const
+{
+	TileHits tileHits{};
+	tileHits.x = static_cast<int>(tileIndex % m_TilesPerRow * m_TileSize);
+	tileHits.y = static_cast<int>(tileIndex / m_TilesPerRow * m_TileSize);
+	const int tileEndX = std::min(tileHits.x + static_cast<int>(m_TileSize), m_Width);
+	const int tileEndY = std::min(tileHits.y + static_cast<int>(m_TileSize), m_Height);
+	tileHits.width = tileEndX - tileHits.x;
+
+	const size_t pixelCount = static_cast<size_t>(tileHits.width) * (tileEndY - tileHits.y);
+	tileHits.viewRays.resize(pixelCount);
+	tileHits.hits.resize(pixelCount);
+	tileHits.testCounts.resize(pixelCount);
+
+	if (m_PacketTracingEnabled)
+	{
+		//The tile size is even, only the last row/column of the frame can end in a partial block
+		for (int py = tileHits.y; py < tileEndY; py += 2)
+		{
+			for (int px = tileHits.x; px < tileEndX; px += 2)
+			{
+				TracePixelBlock(pScene, px, py, aspectRatio, camera, tileHits);
+			}
+		}
+	}
+	else
+	{
+		for (int py = tileHits.y; py < tileEndY; ++py)
+		{
+			for (int px = tileHits.x; px < tileEndX; ++px)
+			{
+				TracePixel(pScene, px, py, aspectRatio, camera, tileHits);
+			}
+		}
+	}
+
+	std::vector<uint32_t> tileLights{};
+	CullTileLights(tileHits, lights, tileLights);
+	tileLightCount = static_cast<uint32_t>(tileLights.size());
+
+	//The pixels of a tile are close together, their shadow rays towards a light are mostly blocked by the same primitive
+	std::vector<uint32_t> lastOccluders(lights.size(), Scene::noOccluder);
+
+	uint32_t rayCount = static_cast<uint32_t>(pixelCount);
+
+	for (int py = tileHits.y; py < tileEndY; ++py)
+	{
+		for (int px = tileHits.x; px < tileEndX; ++px)
+		{
+			const size_t hitIndex = tileHits.GetIndex(px, py);
+			const RayStats shadeStatsBefore = RayStats::GetThreadStats();
+
+			rayCount += ShadePixel(pScene, px, py, tileHits.viewRays[hitIndex], tileHits.hits[hitIndex], lights, materials, tileLights, lastOccluders);
+
+			if (m_CurrentLightingMode == LightingMode::Heatmap)
+				WriteHeatmapPixel(px, py, tileHits.testCounts[hitIndex] + (RayStats::GetThreadStats() - shadeStatsBefore).GetTestCount());
+		}
+	}
+
+	return rayCount;
+}
+
+void dae::Renderer::TracePixel(Scene* pScene, int px, int py, float aspectRatio, const Camera& camera, TileHits& tileHits) const
+{
+	const size_t hitIndex = tileHits.GetIndex(px, py);
+	tileHits.viewRays[hitIndex] = GetViewRay(px, py, aspectRatio, camera);
+
+	const RayStats statsBefore = RayStats::GetThreadStats();
+
+	{
+		PROFILE_ZONE_DETAILED("Scene::GetClosestHit");
+		pScene->GetClosestHit(tileHits.viewRays[hitIndex], tileHits.hits[hitIndex]);
+	}
+
+	tileHits.testCounts[hitIndex] = (RayStats::GetThreadStats() - statsBefore).GetTestCount();
+}
+
+void dae::Renderer::TracePixelBlock(Scene* pScene, int px, int py, float aspectRatio, const Camera& camera, TileHits& tileHits) const
+{
+	if (px + 1 >= m_Width || py + 1 >= m_Height)
+	{
+		for (int y = py; y < std::min(py + 2, m_Height); ++y)
+		{
+			for (int x = px; x < std::min(px + 2, m_Width); ++x)
+			{
+				TracePixel(pScene, x, y, aspectRatio, camera, tileHits);
+			}
+		}
+		return;
+	}
+
+	const Ray viewRays[4]
+	{
+		GetViewRay(px, py, aspectRatio, camera),
+		GetViewRay(px + 1, py, aspectRatio, camera),
+		GetViewRay(px, py + 1, aspectRatio, camera),
+		GetViewRay(px + 1, py + 1, aspectRatio, camera)
+	};
+
+	HitRecord closestHits[4]{};
+	const RayStats statsBefore = RayStats::GetThreadStats();
+
+	{
+		PROFILE_ZONE_DETAILED("Scene::GetClosestHit4");
+		pScene->GetClosestHit4(viewRays, closestHits);
+	}
+
+	//The packet's tests can't be told apart per lane, each pixel gets an equal share of them
+	const uint64_t packetTestCount = (RayStats::GetThreadStats() - statsBefore).GetTestCount();
+
+	for (int i = 0; i < 4; ++i)
+	{
+		const size_t hitIndex = tileHits.GetIndex(px + i % 2, py + i / 2);
+		tileHits.viewRays[hitIndex] = viewRays[i];
+		tileHits.hits[hitIndex] = closestHits[i];
+		tileHits.testCounts[hitIndex] = packetTestCount / 4;
+	}
 }
 
-void dae::Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const
+void dae::Renderer::CullTileLights(const TileHits& tileHits, const std::vector<Light>& lights, std::vector<uint32_t>& tileLights) const
 {
-	const int px = static_cast<int>(pixelIndex) % m_Width;
-	const int py = static_cast<int>(pixelIndex) / m_Width;
+	tileLights.clear();
+	tileLights.reserve(lights.size());
+
+	Vector3 minHit{ FLT_MAX, FLT_MAX, FLT_MAX };
+	Vector3 maxHit{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	bool didHit = false;
+
+	if (m_HasLimitedLights)
+	{
+		for (const HitRecord& hit : tileHits.hits)
+		{
+			if (!hit.didHit)
+				continue;
+
+			minHit = Vector3::Min(minHit, hit.origin);
+			maxHit = Vector3::Max(maxHit, hit.origin);
+			didHit = true;
+		}
+	}
+
+	for (uint32_t i = 0; i < lights.size(); ++i)
+	{
+		if (m_LightRangesSqr[i] != FLT_MAX)
+		{
+			//Closest point of the hit bounds to the light, out of range there means out of range for every pixel of the tile
+			const Vector3 closestPoint = Vector3::Max(minHit, Vector3::Min(lights[i].origin, maxHit));
+			if (!didHit || (lights[i].origin - closestPoint).SqrMagnitude() >= m_LightRangesSqr[i])
+				continue;
+		}
+
+		tileLights.push_back(i);
+	}
+}
 
-	float rx = px + 0.5f;
-	float ry = py + 0.5f;
+Ray dae::Renderer::GetViewRay(int px, int py, float aspectRatio, const Camera& camera) const
+{
+	float rx = px + m_JitterX;
+	float ry = py + m_JitterY;
 
 
 	float x = (2.f * (rx /float(m_Width)) - 1.f) * aspectRatio * camera.fovAngle;
@@ -133,45 +431,61 @@ void dae::Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float aspect
 
 	Vector3 rayDirection{ camera.cameraToWorld.TransformVector(cameraSpaceDir).Normalized() };
 
-	Ray viewRay{ camera.origin, rayDirection };
-
-	ColorRGB finalColor{ };
-
-	HitRecord closestHit{};
+	return Ray{ camera.origin, rayDirection };
+}
 
-	pScene->GetClosestHit(viewRay, closestHit);
+uint32_t dae::Renderer::ShadePixel(Scene* pScene, int px, int py, const Ray& viewRay, const HitRecord& closestHit, const std::vector<Light>& lights, const std::vector<Material>& materials,
+	const std::vector<uint32_t>& tileLights, std::vector<uint32_t>& lastOccluders) const
+{
+	PROFILE_ZONE_DETAILED("Renderer::ShadePixel");
 
+	ColorRGB finalColor{ };
+	uint32_t shadowRayCount = 0;
 
 	if (closestHit.didHit)
 	{
 		const Vector3 offsetOrigin = closestHit.origin + closestHit.normal * 0.001f;
 
 
-		Vector3 lightDir{};
-
-		for (size_t i = 0; i < lights.size(); ++i)
+		//Adds the contribution of one light, scaled by weight (1 when every light is shaded, 1 / (samples * pdf) when sampled)
+		const auto shadeLight = [&](uint32_t i, float weight)
 		{
-			lightDir = LightUtils::GetDirectionToLight(lights[i], offsetOrigin);
+			//The tile's culling is conservative, this pixel can still be out of reach of a light that reaches other pixels of the tile
+			if (m_LightRangesSqr[i] != FLT_MAX && (lights[i].origin - closestHit.origin).SqrMagnitude() >= m_LightRangesSqr[i])
+				return;
+
+			Vector3 lightDir = LightUtils::GetDirectionToLight(lights[i], offsetOrigin);
 
 			const float magnitude = lightDir.Normalize();
 
 			if (m_ShadowsEnabled)
 			{
 				Ray shadowRay{ offsetOrigin, lightDir, 0.0001f, magnitude };
+				++shadowRayCount;
+
+				bool isOccluded{};
+				{
+					PROFILE_ZONE_DETAILED("Scene::IsOccluded");
+					isOccluded = pScene->IsOccluded(shadowRay, lastOccluders[i]);
+				}
 
-				if (pScene->DoesHit(shadowRay))
+				if (isOccluded)
 				{
-					continue;
+					return;
 				}
 			}
 
 			if (Vector3::Dot(closestHit.normal, lightDir) < 0)
-				continue;
+				return;
 
 
 			ColorRGB E = LightUtils::GetRadiance(lights[i], closestHit.origin);
 
-			ColorRGB BRDFrgb = materials[closestHit.materialIndex]->Shade(closestHit, lightDir.Normalized(), viewRay.direction.Normalized());
+			ColorRGB BRDFrgb{};
+			{
+				PROFILE_ZONE_DETAILED("Material::Shade");
+				BRDFrgb = materials[closestHit.materialIndex].Shade(closestHit, lightDir.Normalized(), viewRay.direction.Normalized());
+			}
 
 
 
@@ -179,43 +493,301 @@ void dae::Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float aspect
 			{
 			case LightingMode::ObservedArea:
 
-				finalColor += ColorRGB{ 1.f, 1.f, 1.f } *Vector3::Dot(closestHit.normal, lightDir);
+				finalColor += ColorRGB{ 1.f, 1.f, 1.f } *Vector3::Dot(closestHit.normal, lightDir) * weight;
 				break;
 			case LightingMode::Radiance:
 
-				finalColor += E;
+				finalColor += E * weight;
 				break;
 			case LightingMode::BRDF:
-				finalColor += BRDFrgb;
+				finalColor += BRDFrgb * weight;
 				break;
 			case LightingMode::Combined:
-				finalColor += E * BRDFrgb * (Vector3::Dot(closestHit.normal, lightDir));
+				finalColor += E * BRDFrgb * (Vector3::Dot(closestHit.normal, lightDir)) * weight;
+				break;
+			case LightingMode::Heatmap:
+				//Written by the caller once the pixel's tests are known
 				break;
 			}
+		};
+
+		const LightBVH& lightBVH = pScene->GetLightBVH();
+
+		//Sampling only pays off with more point lights than samples, the tile's list may have culled enough of them
+		//Directional lights are never culled, the rest of the list is point lights
+		const size_t tilePointLightCount = tileLights.size() - lightBVH.GetDirectionalLights().size();
+		if (m_LightSampleCount == 0 || tilePointLightCount <= m_LightSampleCount)
+		{
+			for (const uint32_t i : tileLights)
+			{
+				shadeLight(i, 1.f);
+			}
+		}
+		else
+		{
+			for (const uint32_t i : lightBVH.GetDirectionalLights())
+			{
+				shadeLight(i, 1.f);
+			}
+
+			//Stratified: sample s walks the tree with a number in [s, s + 1) / count, so the picks spread over the lights
+			const float pixelRandom = GetPixelRandom(px, py);
+			const float sampleWeight = 1.f / m_LightSampleCount;
+
+			for (uint32_t s = 0; s < m_LightSampleCount; ++s)
+			{
+				uint32_t lightIdx{};
+				float pdf{};
+				if (lightBVH.Sample(offsetOrigin, closestHit.normal, (s + pixelRandom) * sampleWeight, lightIdx, pdf))
+					shadeLight(lightIdx, sampleWeight / pdf);
+			}
 		}
 	}
 
 
 	//Update Color in Buffer
-	finalColor.MaxToOne();
+	if (m_CurrentLightingMode != LightingMode::Heatmap)
+		WritePixel(px, py, finalColor);
+
+	return shadowRayCount;
+}
+
+void dae::Renderer::WritePixel(int px, int py, const ColorRGB& color) const
+{
+	const size_t pixelIndex = static_cast<size_t>(px) + static_cast<size_t>(py) * m_Width;
+
+	float& r = m_pAccumulation[pixelIndex];
+	float& g = m_pAccumulation[m_AccumulationPlaneSize + pixelIndex];
+	float& b = m_pAccumulation[2 * m_AccumulationPlaneSize + pixelIndex];
+
+	//First sample overwrites, so whatever the buffer held before the reset can't leak in
+	if (m_SampleWeight == 1.f)
+	{
+		r = color.r;
+		g = color.g;
+		b = color.b;
+		return;
+	}
+
+	//Running average: avg += (sample - avg) / n
+	r += (color.r - r) * m_SampleWeight;
+	g += (color.g - g) * m_SampleWeight;
+	b += (color.b - b) * m_SampleWeight;
+}
+
+void dae::Renderer::ResolvePixels(uint32_t firstPixel, uint32_t endPixel)
+{
+	const float* pRed = m_pAccumulation;
+	const float* pGreen = m_pAccumulation + m_AccumulationPlaneSize;
+	const float* pBlue = m_pAccumulation + 2 * m_AccumulationPlaneSize;
+	uint32_t* pPixels = m_Pixels.data();
+	const std::array<uint8_t, gammaLutSize>& gammaLut = GetGammaLut();
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 quantizeScale = _mm_set1_ps(m_GammaEnabled ? gammaLutSize - 1.f : 255.f);
+
+	//Tasks start on multiples of 16 pixels, only the very last pixels of the frame fall outside the 4 wide loop
+	const uint32_t endVector = firstPixel + ((endPixel - firstPixel) & ~3u);
+
+	for (uint32_t i = firstPixel; i < endVector; i += 4)
+	{
+		__m128 r = _mm_load_ps(pRed + i);
+		__m128 g = _mm_load_ps(pGreen + i);
+		__m128 b = _mm_load_ps(pBlue + i);
+
+		switch (m_ToneMapping)
+		{
+		case ToneMapping::MaxToOne:
+		{
+			//Dividing (not multiplying by the reciprocal) so it matches ColorRGB::MaxToOne bit for bit
+			const __m128 divisor = _mm_max_ps(_mm_max_ps(r, g), _mm_max_ps(b, one));
+			r = _mm_div_ps(r, divisor);
+			g = _mm_div_ps(g, divisor);
+			b = _mm_div_ps(b, divisor);
+			break;
+		}
+		case ToneMapping::Reinhard:
+		{
+			const __m128 luminance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(.2126f)), _mm_mul_ps(g, _mm_set1_ps(.7152f))), _mm_mul_ps(b, _mm_set1_ps(.0722f)));
+			const __m128 scale = _mm_div_ps(one, _mm_add_ps(one, _mm_max_ps(luminance, zero)));
+			r = _mm_mul_ps(r, scale);
+			g = _mm_mul_ps(g, scale);
+			b = _mm_mul_ps(b, scale);
+			break;
+		}
+		}
+
+		//Truncating like the scalar (uint8_t) cast, clamped so negative or overshooting channels can't wrap
+		const __m128i ri = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(r, zero), one), quantizeScale));
+		const __m128i gi = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(g, zero), one), quantizeScale));
+		const __m128i bi = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(b, zero), one), quantizeScale));
+
+		if (m_GammaEnabled)
+		{
+			alignas(16) int32_t indices[3][4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(indices[0]), ri);
+			_mm_store_si128(reinterpret_cast<__m128i*>(indices[1]), gi);
+			_mm_store_si128(reinterpret_cast<__m128i*>(indices[2]), bi);
+
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				pPixels[i + lane] = 0xFF000000u
+					| static_cast<uint32_t>(gammaLut[indices[0][lane]]) << 16
+					| static_cast<uint32_t>(gammaLut[indices[1][lane]]) << 8
+					| static_cast<uint32_t>(gammaLut[indices[2][lane]]);
+			}
+			continue;
+		}
+
+		const __m128i argb = _mm_or_si128(_mm_or_si128(_mm_set1_epi32(static_cast<int>(0xFF000000u)), _mm_slli_epi32(ri, 16)), _mm_or_si128(_mm_slli_epi32(gi, 8), bi));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pPixels + i), argb);
+	}
+
+	for (uint32_t i = endVector; i < endPixel; ++i)
+	{
+		ColorRGB color{ pRed[i], pGreen[i], pBlue[i] };
+
+		if (m_ToneMapping == ToneMapping::MaxToOne)
+			color.MaxToOne();
+		else
+			color *= 1.f / (1.f + std::max(.2126f * color.r + .7152f * color.g + .0722f * color.b, 0.f));
+
+		const auto quantize = [&](float channel)
+		{
+			channel = std::clamp(channel, 0.f, 1.f);
+			return m_GammaEnabled ? static_cast<uint32_t>(gammaLut[static_cast<int>(channel * (gammaLutSize - 1))]) : static_cast<uint32_t>(channel * 255);
+		};
+
+		pPixels[i] = 0xFF000000u | quantize(color.r) << 16 | quantize(color.g) << 8 | quantize(color.b);
+	}
+}
+
+void dae::Renderer::WriteHeatmapPixel(int px, int py, uint64_t testCount) const
+{
+	//Blue -> cyan -> green -> yellow -> red, each stretch covering a quarter of [0, heatmapMaxTests]
+	const float heat = std::min(static_cast<float>(testCount) / heatmapMaxTests, 1.f) * 4.f;
+
+	ColorRGB color{};
+	if (heat < 1.f)
+		color = ColorRGB{ 0.f, heat, 1.f };
+	else if (heat < 2.f)
+		color = ColorRGB{ 0.f, 1.f, 2.f - heat };
+	else if (heat < 3.f)
+		color = ColorRGB{ heat - 2.f, 1.f, 0.f };
+	else
+		color = ColorRGB{ 1.f, 4.f - heat, 0.f };
+
+	WritePixel(px, py, color);
+}
+
+
+void Renderer::PrintTileStats() const
+{
+	if (m_TileTimesMs.empty())
+		return;
+
+	float totalMs{};
+	size_t slowestTile{};
+
+	for (size_t i = 0; i < m_TileTimesMs.size(); ++i)
+	{
+		totalMs += m_TileTimesMs[i];
 
+		if (m_TileTimesMs[i] > m_TileTimesMs[slowestTile])
+			slowestTile = i;
+	}
+
+	std::cout << "Tiles: " << m_TileTimesMs.size() << " (" << m_TileSize << "x" << m_TileSize << ")"
+		<< ", avg " << totalMs / m_TileTimesMs.size() << " ms"
+		<< ", slowest " << m_TileTimesMs[slowestTile] << " ms at tile (" << slowestTile % m_TilesPerRow << ", " << slowestTile / m_TilesPerRow << ")"
+		<< ", " << GetThreadCount() << " threads"
+		<< ", " << m_FrameLightsPerTile << " lights/tile"
+		<< std::endl;
+}
+
+uint32_t Renderer::GetThreadCount() const
+{
+#if defined(THREAD_POOL)
+	return m_pThreadPool->GetThreadCount();
+#elif defined(PARALLEL_FOR)
+	return std::max(std::thread::hardware_concurrency(), 1u);
+#else
+	return 1;
+#endif
+}
+
+void Renderer::PrintRayStats() const
+{
+	if (m_FrameRayStats.rays == 0)
+		return;
+
+	const double rays = static_cast<double>(m_FrameRayStats.rays);
+
+	std::cout << "Rays: " << m_FrameRayStats.rays << " (" << rays / (m_FrameTraceMs * 1000.0) << " Mrays/s)"
+		<< ", tests/ray: " << m_FrameRayStats.GetTestCount() / rays
+		<< " (box " << m_FrameRayStats.boxTests / rays
+		<< ", triangle " << m_FrameRayStats.triangleTests / rays
+		<< ", sphere/plane " << m_FrameRayStats.primitiveTests / rays << ")" << std::endl;
+}
+
+bool Renderer::SaveBufferToImage(const std::string& path) const
+{
+	//Wraps the framebuffer without copying, SDL only reads from it
+	SDL_Surface* pImage = SDL_CreateRGBSurfaceWithFormatFrom(const_cast<uint32_t*>(m_Pixels.data()), m_Width, m_Height, 32,
+		m_Width * static_cast<int>(sizeof(uint32_t)), SDL_PIXELFORMAT_ARGB8888);
 
-	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255),
-		static_cast<uint8_t>(finalColor.g * 255),
-		static_cast<uint8_t>(finalColor.b * 255));
+	if (!pImage)
+		return false;
 
+	const bool saved = SDL_SaveBMP(pImage, path.c_str()) == 0;
+	SDL_FreeSurface(pImage);
+	return saved;
+}
+
+float dae::Renderer::GetHalton(uint32_t index, uint32_t base)
+{
+	float result = 0.f;
+	float fraction = 1.f;
+
+	while (index > 0)
+	{
+		fraction /= base;
+		result += fraction * (index % base);
+		index /= base;
+	}
+
+	return result;
+}
 
+float dae::Renderer::GetPixelRandom(int px, int py) const
+{
+	const uint32_t pixelIndex = static_cast<uint32_t>(px + py * m_Width);
+	return (HashPCG(pixelIndex ^ HashPCG(m_SampleCount)) >> 8) * 0x1p-24f;
 }
 
+void dae::Renderer::CycleToneMapping()
+{
+	m_ToneMapping = m_ToneMapping == ToneMapping::MaxToOne ? ToneMapping::Reinhard : ToneMapping::MaxToOne;
+}
 
-bool Renderer::SaveBufferToImage() const
+const char* dae::Renderer::GetToneMappingName() const
 {
-	return SDL_SaveBMP(m_pBuffer, "RayTracing_Buffer.bmp");
+	switch (m_ToneMapping)
+	{
+	case ToneMapping::MaxToOne:
+		return "MaxToOne";
+	case ToneMapping::Reinhard:
+		return "Reinhard";
+	}
+
+	return "";
 }
 
 void dae::Renderer::CycleLightingMode()
 {
+	m_SampleCount = 0;
+
 	switch (m_CurrentLightingMode)
 	{
 	case LightingMode::ObservedArea:
@@ -228,6 +800,9 @@ void dae::Renderer::CycleLightingMode()
 		m_CurrentLightingMode = LightingMode::Combined;
 		break;
 	case LightingMode::Combined:
+		m_CurrentLightingMode = LightingMode::Heatmap;
+		break;
+	case LightingMode::Heatmap:
 		m_CurrentLightingMode = LightingMode::ObservedArea;
 		break;
 	default:
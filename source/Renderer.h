@@ -1,10 +1,16 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
 
 
 #include "Camera.h"
+#include "DataTypes.h"
 #include "Material.h"
+#include "RayStats.h"
 
 
 struct SDL_Window;
@@ -13,24 +19,68 @@ struct SDL_Surface;
 namespace dae
 {
 	class Scene;
+	class ThreadPool;
 
 	class Renderer final
 	{
 	public:
+		//Renders into the renderer's framebuffer, which is copied to the window surface at the end of every frame
 		Renderer(SDL_Window* pWindow);
-		~Renderer() = default;
+		//Headless: only the framebuffer, no window or SDL video subsystem needed
+		Renderer(int width, int height);
+		~Renderer();
 
 		Renderer(const Renderer&) = delete;
 		Renderer(Renderer&&) noexcept = delete;
 		Renderer& operator=(const Renderer&) = delete;
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
-		void Render(Scene* pScene) const;
-		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const;
-		bool SaveBufferToImage() const;
+		void Render(Scene* pScene);
+		//Writes the framebuffer as a .bmp, returns false on failure (see SDL_GetError)
+		bool SaveBufferToImage(const std::string& path = "RayTracing_Buffer.bmp") const;
+
+		int GetWidth() const { return m_Width; }
+		int GetHeight() const { return m_Height; }
+		//ARGB8888, row major, resolved from the accumulation buffer at the end of every frame
+		const std::vector<uint32_t>& GetPixels() const { return m_Pixels; }
 
 		void CycleLightingMode();
-		void ToggleShadows() { m_ShadowsEnabled = !m_ShadowsEnabled; }
+		void ToggleShadows() { m_ShadowsEnabled = !m_ShadowsEnabled; m_SampleCount = 0; }
+		void CycleToneMapping();
+		const char* GetToneMappingName() const;
+		void ToggleGamma() { m_GammaEnabled = !m_GammaEnabled; }
+		bool IsGammaEnabled() const { return m_GammaEnabled; }
+		void TogglePacketTracing() { m_PacketTracingEnabled = !m_PacketTracingEnabled; }
+		bool IsPacketTracingEnabled() const { return m_PacketTracingEnabled; }
+		//While the camera and scene don't change, every frame adds one jittered sample per pixel to a running average
+		//Off: every frame is a single centered sample, so frames stay equal work (benchmarks)
+		void SetProgressiveEnabled(bool isEnabled) { m_ProgressiveEnabled = isEnabled; m_SampleCount = 0; }
+		bool IsProgressiveEnabled() const { return m_ProgressiveEnabled; }
+		//Samples per pixel in the accumulation buffer, tracing stops once it reaches maxProgressiveSamples
+		uint32_t GetSampleCount() const { return m_SampleCount; }
+		//0: every light is shaded, otherwise this many point lights are picked per shading point through the scene's LightBVH
+		//(unbiased, noisy, meant to be used with progressive accumulation), directional lights are always shaded
+		void SetLightSampleCount(uint32_t lightSampleCount) { m_LightSampleCount = lightSampleCount; m_SampleCount = 0; }
+		uint32_t GetLightSampleCount() const { return m_LightSampleCount; }
+		//Above 0, point lights stop where the irradiance of their brightest channel drops below this (on top of their own range)
+		//Every tile only shades the lights that reach the bounds of its hit points, 0: only the lights' own ranges limit them
+		void SetLightCutoff(float cutoffIrradiance) { m_LightCutoff = std::max(cutoffIrradiance, 0.f); m_SampleCount = 0; }
+		float GetLightCutoff() const { return m_LightCutoff; }
+
+		//The frame is rendered in square tiles of tileSize pixels, rounded up to an even size so 2x2 packets never straddle two tiles
+		void SetTileSize(uint32_t tileSize) { m_TileSize = std::max((tileSize + 1) & ~1u, 2u); }
+		uint32_t GetTileSize() const { return m_TileSize; }
+		//Render duration of every tile during the last frame, row major
+		const std::vector<float>& GetTileTimesMs() const { return m_TileTimesMs; }
+		//Primary + shadow rays traced during the last frame
+		uint64_t GetLastFrameRayCount() const { return m_FrameRayStats.rays; }
+		//Rays and intersection tests of the last frame, merged from the per tile counts
+		const RayStats& GetLastFrameRayStats() const { return m_FrameRayStats; }
+		void PrintTileStats() const;
+		//Rays/s (over the time spent tracing) and intersection tests per ray of the last frame
+		void PrintRayStats() const;
+		//Threads the tiles are spread over
+		uint32_t GetThreadCount() const;
 
 	private:
 
@@ -39,18 +89,105 @@ namespace dae
 			ObservedArea, //Lambert Cosine Law
 			Radiance, //Incident Radiance
 			BRDF, //Scattering of The Light
-			Combined //ObservedArea * Radiance * BRDF
+			Combined, //ObservedArea * Radiance * BRDF
+			Heatmap //Intersection tests spent on the pixel, blue (none) to red (heatmapMaxTests or more)
+		};
+
+		//How the linear colors of the accumulation buffer are brought into [0, 1] during the resolve
+		enum class ToneMapping
+		{
+			MaxToOne, //Divide by the largest channel when it exceeds 1, keeps the hue
+			Reinhard //Luminance based, c / (1 + L)
+		};
+
+		static constexpr float heatmapMaxTests{ 256.f };
+		static constexpr uint32_t resolvePixelsPerTask{ 16384 }; //Multiple of 16 so every task starts on a cache line of each plane
+		static constexpr uint32_t maxProgressiveSamples{ 256 };
+
+		//Primary rays of a tile and what they hit, row major over the tile
+		//The whole tile is traced before any pixel is shaded, so its lights can be culled against the hit points
+		struct TileHits
+		{
+			int x{};
+			int y{};
+			int width{};
+
+			std::vector<Ray> viewRays{};
+			std::vector<HitRecord> hits{};
+			std::vector<uint64_t> testCounts{}; //Intersection tests of the primary ray, for the heatmap
+
+			size_t GetIndex(int px, int py) const { return static_cast<size_t>(px - x) + static_cast<size_t>(py - y) * width; }
 		};
 
 		LightingMode m_CurrentLightingMode{ LightingMode::Combined };
+		ToneMapping m_ToneMapping{ ToneMapping::MaxToOne };
+		bool m_GammaEnabled{ false };
 		bool m_ShadowsEnabled{ true };
+		bool m_PacketTracingEnabled{ true };
+		bool m_ProgressiveEnabled{ true };
+		uint32_t m_LightSampleCount{};
+		float m_LightCutoff{};
+
+		//Squared LightUtils::GetRange of every light for this frame, FLT_MAX when unlimited
+		std::vector<float> m_LightRangesSqr{};
+		bool m_HasLimitedLights{};
 
 		SDL_Window* m_pWindow{};
 
 		SDL_Surface* m_pBuffer{};
-		uint32_t* m_pBufferPixels{};
+		std::vector<uint32_t> m_Pixels{};
+
+		//Linear HDR color of every pixel as three planes (r, g, b), each m_AccumulationPlaneSize floats and cache line aligned
+		AlignedFloats m_Accumulation{};
+		float* m_pAccumulation{}; //m_Accumulation.data(), written by the const per pixel functions
+		size_t m_AccumulationPlaneSize{};
+
+		//What the accumulated samples were traced with, any difference restarts the average
+		const Scene* m_pAccumulatedScene{};
+		uint64_t m_AccumulatedSceneVersion{};
+		Matrix m_AccumulatedCameraToWorld{};
+		float m_AccumulatedFovAngle{};
+		uint32_t m_SampleCount{};
+		//Sub-pixel position of this frame's sample, the same for every pixel, and its weight in the running average
+		float m_JitterX{ .5f };
+		float m_JitterY{ .5f };
+		float m_SampleWeight{ 1.f };
 
 		int m_Width{};
 		int m_Height{};
+
+		std::unique_ptr<ThreadPool> m_pThreadPool{};
+		uint32_t m_TileSize{ 16 };
+		uint32_t m_TilesPerRow{};
+		std::vector<float> m_TileTimesMs{};
+		std::vector<RayStats> m_TileRayStats{}; //Per tile so threads never share a counter
+		std::vector<uint32_t> m_TileLightCounts{};
+		float m_FrameLightsPerTile{}; //Lights left after culling, averaged over the tiles of the last frame
+		RayStats m_FrameRayStats{};
+		float m_FrameTraceMs{}; //Time spent on the tiles of the last frame
+
+		//Returns the number of rays traced (primary + shadow rays), tileLightCount receives how many lights survived the tile's culling
+		uint32_t RenderTile(Scene* pScene, uint32_t tileIndex, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials,
+			uint32_t& tileLightCount) const;
+		//Traces the primary ray of pixel (px, py) into tileHits
+		void TracePixel(Scene* pScene, int px, int py, float aspectRatio, const Camera& camera, TileHits& tileHits) const;
+		//Traces the primary rays of the 2x2 pixel block starting at (px, py) as one packet, falls back to TracePixel on the frame's last row/column
+		void TracePixelBlock(Scene* pScene, int px, int py, float aspectRatio, const Camera& camera, TileHits& tileHits) const;
+		//Indices of the lights that can reach any hit point of the tile: unlimited lights and range spheres overlapping the hit points' bounds
+		void CullTileLights(const TileHits& tileHits, const std::vector<Light>& lights, std::vector<uint32_t>& tileLights) const;
+		Ray GetViewRay(int px, int py, float aspectRatio, const Camera& camera) const;
+		//Returns the number of shadow rays traced
+		//tileLights: the lights worth shading (see CullTileLights), lastOccluders: per light, what blocked its previous shadow ray (see Scene::IsOccluded)
+		uint32_t ShadePixel(Scene* pScene, int px, int py, const Ray& viewRay, const HitRecord& closestHit, const std::vector<Light>& lights, const std::vector<Material>& materials,
+			const std::vector<uint32_t>& tileLights, std::vector<uint32_t>& lastOccluders) const;
+		void WritePixel(int px, int py, const ColorRGB& color) const;
+		void WriteHeatmapPixel(int px, int py, uint64_t testCount) const;
+		void AllocateBuffers();
+		//Radical inverse of index in base, low discrepancy sub-pixel offsets in [0, 1)
+		static float GetHalton(uint32_t index, uint32_t base);
+		//Uniform in [0, 1), different per pixel and per progressive sample
+		float GetPixelRandom(int px, int py) const;
+		//Tone maps, gamma corrects and packs the pixels [firstPixel, endPixel) of the accumulation buffer into m_Pixels, 4 at a time
+		void ResolvePixels(uint32_t firstPixel, uint32_t endPixel);
 	};
 }
@@ -1,7 +1,10 @@
 #include "Scene.h"
 #include "Utils.h"
 #include "Material.h"
+#include "MeshLoader.h"
 #include <algorithm>
+#include <filesystem>
+#include <iostream>
 
 
 namespace dae {
@@ -9,92 +12,420 @@ namespace dae {
 #pragma region Base Scene
 	//Initialize Scene with Default Solid Color Material (RED)
 	Scene::Scene():
-		m_Materials({ new Material_SolidColor( colors::Red)})
+		m_Materials({ Material::SolidColor(colors::Red) })
 	{
 
 		m_SphereGeometries.reserve(32);
 		m_PlaneGeometries.reserve(32);
+		m_Triangles.reserve(32);
 		m_TriangleMeshGeometries.reserve(32);
 		m_Lights.reserve(32);
 	}
 
-	Scene::~Scene()
+	Scene::~Scene() = default;
+
+	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
 	{
-		for(auto& pMaterial : m_Materials)
+
+		//Traversal only keeps the distance and ids of the closest primitive, like the packet path
+		float closestT{ closestHit.t };
+		uint32_t closestPrimitiveIdx{ HitRecord4::noHit };
+		uint32_t closestTriangleIdx{};
+
+		//Infinite planes first, they can't be bounded but their hit culls everything behind them in the BVH
+		const uint32_t firstPlaneIdx{ static_cast<uint32_t>(m_ScenePrimitives.size()) };
+		for (uint32_t planeIdx{}; planeIdx < m_PlaneGeometries.size(); ++planeIdx)
 		{
-			delete pMaterial;
-			pMaterial = nullptr;
+			float t{};
+			if (GeometryUtils::HitTest_Plane(m_PlaneGeometries[planeIdx], ray, t) && t < closestT)
+			{
+				closestT = t;
+				closestPrimitiveIdx = firstPlaneIdx + planeIdx;
+			}
 		}
 
-		m_Materials.clear();
+		const std::vector<uint32_t>& primitiveIndices{ m_SceneBVH.GetPrimitiveIndices() };
+		GeometryUtils::Traverse_BVH(m_SceneBVH, ray, closestT, false, [&](uint32_t primitiveSlot)
+			{
+				const uint32_t primitiveIdx{ primitiveIndices[primitiveSlot] };
+				if (!HitTest_ScenePrimitive(m_ScenePrimitives[primitiveIdx], ray, closestT, closestTriangleIdx))
+					return false;
+
+				closestPrimitiveIdx = primitiveIdx;
+				return true;
+			});
+
+		if (closestPrimitiveIdx != HitRecord4::noHit)
+			SetHitRecord(closestPrimitiveIdx, closestTriangleIdx, ray, closestT, closestHit);
 	}
 
-	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
+	void Scene::GetClosestHit4(const Ray (&rays)[4], HitRecord (&closestHits)[4]) const
 	{
+		const Ray4 ray{ rays };
+		HitRecord4 closestHit{};
 
-		HitRecord hitRecord{};
-		for (const auto& sphere : m_SphereGeometries)
+		//Lanes in hit take t and the primitive id where they get closer than before
+		const auto updateClosest = [&](__m128 hit, const __m128& t, uint32_t primitiveIdx, const uint32_t* pTriangleIdx = nullptr)
 		{
-			if (GeometryUtils::HitTest_Sphere(sphere, ray, hitRecord))
+			hit = _mm_and_ps(hit, _mm_cmplt_ps(t, closestHit.t));
+
+			const int hitMask{ _mm_movemask_ps(hit) };
+			if (hitMask == 0)
+				return;
+
+			closestHit.t = GeometryUtils::Select4(hit, t, closestHit.t);
+			for (int lane{}; lane < 4; ++lane)
 			{
-				if (hitRecord.t < closestHit.t)
-					closestHit = hitRecord;
+				if ((hitMask & (1 << lane)) == 0) continue;
+
+				closestHit.primitiveIdx[lane] = primitiveIdx;
+				if (pTriangleIdx)
+					closestHit.triangleIdx[lane] = pTriangleIdx[lane];
 			}
+		};
+
+		//Planes get the ids after the BVH primitives
+		const uint32_t firstPlaneIdx{ static_cast<uint32_t>(m_ScenePrimitives.size()) };
+		for (uint32_t planeIdx{}; planeIdx < m_PlaneGeometries.size(); ++planeIdx)
+		{
+			__m128 t{};
+			const __m128 hit{ GeometryUtils::HitTest_Plane4(m_PlaneGeometries[planeIdx], ray, t) };
+			updateClosest(hit, t, firstPlaneIdx + planeIdx);
 		}
 
-		for (const auto& plane : m_PlaneGeometries)
+		const std::vector<uint32_t>& primitiveIndices{ m_SceneBVH.GetPrimitiveIndices() };
+		GeometryUtils::Traverse_BVHPacket(m_SceneBVH, ray, closestHit.t, _mm_castsi128_ps(_mm_set1_epi32(-1)), [&](uint32_t primitiveSlot, const __m128& activeLanes)
+			{
+				const uint32_t primitiveIdx{ primitiveIndices[primitiveSlot] };
+				const ScenePrimitive& primitive{ m_ScenePrimitives[primitiveIdx] };
+
+				__m128 t{};
+				switch (primitive.type)
+				{
+				case ScenePrimitiveType::Sphere:
+					updateClosest(_mm_and_ps(activeLanes, GeometryUtils::HitTest_Sphere4(m_SphereGeometries[primitive.index], ray, t)), t, primitiveIdx);
+					break;
+				case ScenePrimitiveType::Triangle:
+					updateClosest(_mm_and_ps(activeLanes, GeometryUtils::HitTest_Triangle4(m_Triangles[primitive.index], ray, t)), t, primitiveIdx);
+					break;
+				case ScenePrimitiveType::TriangleMesh:
+				{
+					uint32_t triangleIdx[4]{};
+					t = closestHit.t;
+					const __m128 hit{ GeometryUtils::HitTest_TriangleMesh4(m_TriangleMeshGeometries[primitive.index], ray, activeLanes, t, triangleIdx) };
+					updateClosest(hit, t, primitiveIdx, triangleIdx);
+					break;
+				}
+				}
+			});
+
+		//Resolve the closest primitive of every lane into a full hit record, the lanes computed the same t as the scalar tests
+		float closestT[4];
+		_mm_storeu_ps(closestT, closestHit.t);
+
+		for (int lane{}; lane < 4; ++lane)
 		{
-			if (GeometryUtils::HitTest_Plane(plane, ray, hitRecord))
+			HitRecord& hitRecord{ closestHits[lane] };
+			hitRecord = HitRecord{};
+
+			if (closestHit.primitiveIdx[lane] != HitRecord4::noHit)
+				SetHitRecord(closestHit.primitiveIdx[lane], closestHit.triangleIdx[lane], rays[lane], closestT[lane], hitRecord);
+		}
+	}
+
+	bool Scene::IsOccluded(const Ray& ray, uint32_t& lastOccluderIdx) const
+	{
+		//An id from another scene (or before primitives were added) is simply ignored
+		const uint32_t firstPlaneIdx{ static_cast<uint32_t>(m_ScenePrimitives.size()) };
+		const uint32_t cachedIdx{ lastOccluderIdx < firstPlaneIdx + m_PlaneGeometries.size() ? lastOccluderIdx : noOccluder };
+
+		if (cachedIdx != noOccluder && Occludes(cachedIdx, ray))
+			return true;
+
+		float maxT{ ray.max };
+		const std::vector<uint32_t>& primitiveIndices{ m_SceneBVH.GetPrimitiveIndices() };
+		if (GeometryUtils::Traverse_BVH(m_SceneBVH, ray, maxT, true, [&](uint32_t primitiveSlot)
 			{
-				if (hitRecord.t < closestHit.t)
-					closestHit = hitRecord;
-			}
+				const uint32_t primitiveIdx{ primitiveIndices[primitiveSlot] };
+				if (primitiveIdx == cachedIdx || !Occludes(primitiveIdx, ray))
+					return false;
+
+				lastOccluderIdx = primitiveIdx;
+				return true;
+			}))
+		{
+			return true;
 		}
 
-		for (const auto& mesh : m_TriangleMeshGeometries)
+		for (uint32_t planeIdx{}; planeIdx < m_PlaneGeometries.size(); ++planeIdx)
 		{
-			if (GeometryUtils::HitTest_TriangleMesh(mesh, ray, hitRecord))
-			{
-				if (hitRecord.t < closestHit.t)
-					closestHit = hitRecord;
-			}
+			if (firstPlaneIdx + planeIdx == cachedIdx || !GeometryUtils::HitTest_Plane(m_PlaneGeometries[planeIdx], ray))
+				continue;
+
+			lastOccluderIdx = firstPlaneIdx + planeIdx;
+			return true;
 		}
 
+		return false;
 	}
 
-	bool Scene::DoesHit(const Ray& ray) const
+	bool Scene::Occludes(uint32_t primitiveIdx, const Ray& ray) const
 	{
+		const uint32_t firstPlaneIdx{ static_cast<uint32_t>(m_ScenePrimitives.size()) };
+		if (primitiveIdx >= firstPlaneIdx)
+			return GeometryUtils::HitTest_Plane(m_PlaneGeometries[primitiveIdx - firstPlaneIdx], ray);
 
-		for (const Sphere& s : m_SphereGeometries)
+		const ScenePrimitive& primitive{ m_ScenePrimitives[primitiveIdx] };
+		switch (primitive.type)
 		{
-			if (GeometryUtils::HitTest_Sphere(s, ray))
-			{
-				return true;
-			}
+		case ScenePrimitiveType::Sphere:
+			return GeometryUtils::HitTest_Sphere(m_SphereGeometries[primitive.index], ray);
+		case ScenePrimitiveType::Triangle:
+			return GeometryUtils::HitTest_Triangle(m_Triangles[primitive.index], ray);
+		case ScenePrimitiveType::TriangleMesh:
+			return GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[primitive.index], ray);
 		}
 
-		for (const TriangleMesh& Tm : m_TriangleMeshGeometries)
+		return false;
+	}
+
+	bool Scene::HitTest_ScenePrimitive(const ScenePrimitive& primitive, const Ray& ray, float& t, uint32_t& triangleIdx) const
+	{
+		float hitT{};
+
+		switch (primitive.type)
 		{
-			if (GeometryUtils::HitTest_TriangleMesh(Tm, ray))
-			{
-				return true;
-			}
-		} 
+		case ScenePrimitiveType::Sphere:
+			if (!GeometryUtils::HitTest_Sphere(m_SphereGeometries[primitive.index], ray, hitT))
+				return false;
+			break;
+		case ScenePrimitiveType::Triangle:
+			if (!GeometryUtils::HitTest_Triangle(m_Triangles[primitive.index], ray, hitT))
+				return false;
+			break;
+		case ScenePrimitiveType::TriangleMesh:
+			//Already limited to hits closer than t
+			return GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[primitive.index], ray, t, triangleIdx);
+		}
 
+		if (hitT >= t)
+			return false;
 
-		for (const Plane& p : m_PlaneGeometries)
+		t = hitT;
+		return true;
+	}
+
+	void Scene::SetHitRecord(uint32_t primitiveIdx, uint32_t triangleIdx, const Ray& ray, float t, HitRecord& hitRecord) const
+	{
+		const uint32_t firstPlaneIdx{ static_cast<uint32_t>(m_ScenePrimitives.size()) };
+		if (primitiveIdx >= firstPlaneIdx)
 		{
-			if (GeometryUtils::HitTest_Plane(p, ray))
-			{
-				return true;
-			}
+			GeometryUtils::SetHitRecord_Plane(m_PlaneGeometries[primitiveIdx - firstPlaneIdx], ray, t, hitRecord);
+			return;
 		}
 
-		return false;
+		const ScenePrimitive& primitive{ m_ScenePrimitives[primitiveIdx] };
+		switch (primitive.type)
+		{
+		case ScenePrimitiveType::Sphere:
+			GeometryUtils::SetHitRecord_Sphere(m_SphereGeometries[primitive.index], ray, t, hitRecord);
+			break;
+		case ScenePrimitiveType::Triangle:
+			GeometryUtils::SetHitRecord_Triangle(m_Triangles[primitive.index], ray, t, hitRecord);
+			break;
+		case ScenePrimitiveType::TriangleMesh:
+			GeometryUtils::SetHitRecord_TriangleMesh(m_TriangleMeshGeometries[primitive.index], triangleIdx, ray, t, hitRecord);
+			break;
+		}
+	}
+
+	void Scene::UpdateSceneBVH()
+	{
+		//Any light difference changes the image, and the hierarchy's bounds and power no longer match what it samples
+		const auto isSameLight = [](const Light& a, const Light& b)
+		{
+			return a.type == b.type && a.intensity == b.intensity && a.range == b.range
+				&& a.origin.x == b.origin.x && a.origin.y == b.origin.y && a.origin.z == b.origin.z
+				&& a.direction.x == b.direction.x && a.direction.y == b.direction.y && a.direction.z == b.direction.z
+				&& a.color.r == b.color.r && a.color.g == b.color.g && a.color.b == b.color.b;
+		};
+
+		if (!std::equal(m_Lights.begin(), m_Lights.end(), m_LastLights.begin(), m_LastLights.end(), isSameLight))
+		{
+			m_LightBVH.Build(m_Lights);
+			m_LastLights = m_Lights;
+			++m_Version;
+		}
+
+		m_ScenePrimitives.clear();
+		m_PrimitiveMinAABBs.clear();
+		m_PrimitiveMaxAABBs.clear();
+
+		for (uint32_t i{}; i < m_SphereGeometries.size(); ++i)
+		{
+			const Sphere& sphere{ m_SphereGeometries[i] };
+			const Vector3 extent{ sphere.radius, sphere.radius, sphere.radius };
+
+			m_ScenePrimitives.push_back({ ScenePrimitiveType::Sphere, i });
+			m_PrimitiveMinAABBs.emplace_back(sphere.origin - extent);
+			m_PrimitiveMaxAABBs.emplace_back(sphere.origin + extent);
+		}
+
+		for (uint32_t i{}; i < m_Triangles.size(); ++i)
+		{
+			const Triangle& triangle{ m_Triangles[i] };
+
+			m_ScenePrimitives.push_back({ ScenePrimitiveType::Triangle, i });
+			m_PrimitiveMinAABBs.emplace_back(Vector3::Min(triangle.v0, Vector3::Min(triangle.v1, triangle.v2)));
+			m_PrimitiveMaxAABBs.emplace_back(Vector3::Max(triangle.v0, Vector3::Max(triangle.v1, triangle.v2)));
+		}
+
+		for (uint32_t i{}; i < m_TriangleMeshGeometries.size(); ++i)
+		{
+			const TriangleMesh& mesh{ m_TriangleMeshGeometries[i] };
+
+			m_ScenePrimitives.push_back({ ScenePrimitiveType::TriangleMesh, i });
+			m_PrimitiveMinAABBs.emplace_back(mesh.transformedminAABB);
+			m_PrimitiveMaxAABBs.emplace_back(mesh.transformedMaxAABB);
+		}
+
+		bool haveMeshesChanged{ m_LastMeshTransforms.size() != m_TriangleMeshGeometries.size() };
+		m_LastMeshTransforms.resize(m_TriangleMeshGeometries.size());
+		m_LastMeshGeometryVersions.resize(m_TriangleMeshGeometries.size());
+
+		for (size_t i{}; i < m_TriangleMeshGeometries.size(); ++i)
+		{
+			const TriangleMesh& mesh{ m_TriangleMeshGeometries[i] };
+			if (m_LastMeshTransforms[i] == mesh.transform && m_LastMeshGeometryVersions[i] == mesh.geometryVersion)
+				continue;
+
+			m_LastMeshTransforms[i] = mesh.transform;
+			m_LastMeshGeometryVersions[i] = mesh.geometryVersion;
+			haveMeshesChanged = true;
+		}
+
+		const auto isEqual = [](const Vector3& a, const Vector3& b) { return a.x == b.x && a.y == b.y && a.z == b.z; };
+		const bool haveBoundsChanged{ !std::equal(m_PrimitiveMinAABBs.begin(), m_PrimitiveMinAABBs.end(), m_BuiltMinAABBs.begin(), m_BuiltMinAABBs.end(), isEqual)
+			|| !std::equal(m_PrimitiveMaxAABBs.begin(), m_PrimitiveMaxAABBs.end(), m_BuiltMaxAABBs.begin(), m_BuiltMaxAABBs.end(), isEqual) };
+
+		if (haveMeshesChanged || haveBoundsChanged)
+			++m_Version;
+
+		//Static scenes: nothing moved since the last build, keep the current hierarchy
+		if (!haveBoundsChanged)
+			return;
+
+		//Same primitives that moved: refit, the BVH rebuilds by itself once the overlap degrades too much
+		m_SceneBVH.RefitFromBounds(m_PrimitiveMinAABBs, m_PrimitiveMaxAABBs);
+
+		m_BuiltMinAABBs = m_PrimitiveMinAABBs;
+		m_BuiltMaxAABBs = m_PrimitiveMaxAABBs;
+	}
+
+	void Scene::ToggleBVH()
+	{
+		m_BVHEnabled = !m_BVHEnabled;
+
+		for (auto& mesh : m_TriangleMeshGeometries)
+		{
+			mesh.SetBVH(m_BVHEnabled);
+		}
+	}
+
+	void Scene::ToggleBVHRefit()
+	{
+		const bool refitEnabled{ !m_SceneBVH.IsRefitEnabled() };
+
+		m_SceneBVH.SetRefitEnabled(refitEnabled);
+		for (auto& mesh : m_TriangleMeshGeometries)
+		{
+			mesh.bvh.SetRefitEnabled(refitEnabled);
+		}
+	}
+
+	void Scene::SetBVHRefitThreshold(float maxOverlapIncrease)
+	{
+		m_SceneBVH.SetRefitThreshold(maxOverlapIncrease);
+		for (auto& mesh : m_TriangleMeshGeometries)
+		{
+			mesh.bvh.SetRefitThreshold(maxOverlapIncrease);
+		}
+	}
+
+	void Scene::ToggleWideBVH()
+	{
+		const bool wideNodesEnabled{ !m_SceneBVH.IsWideNodesEnabled() };
+
+		m_SceneBVH.SetWideNodesEnabled(wideNodesEnabled);
+		for (auto& mesh : m_TriangleMeshGeometries)
+		{
+			mesh.bvh.SetWideNodesEnabled(wideNodesEnabled);
+		}
+	}
+
+	void Scene::CycleMeshBVHBuilder()
+	{
+		m_MeshBVHBuilder = static_cast<BVHBuilder>((static_cast<int>(m_MeshBVHBuilder) + 1) % 3);
+
+		for (auto& mesh : m_TriangleMeshGeometries)
+		{
+			mesh.SetBVHBuilder(m_MeshBVHBuilder);
+			mesh.UpdateTransforms();
+		}
+	}
+
+	const char* Scene::GetMeshBVHBuilderName() const
+	{
+		switch (m_MeshBVHBuilder)
+		{
+		case BVHBuilder::SweepSAH:
+			return "Sweep SAH";
+		case BVHBuilder::BinnedSAH:
+			return "Binned SAH";
+		case BVHBuilder::LBVH:
+			return "LBVH";
+		}
+
+		return "";
+	}
+
+	void Scene::PrintBVHStats() const
+	{
+		const BVHStats& sceneStats{ m_SceneBVH.GetStats() };
+
+		std::cout << "Refit threshold: " << GetBVHRefitThreshold() << std::endl;
+		std::cout << "Scene BVH: " << sceneStats.nodeCount << " nodes, "
+			<< (sceneStats.lastUpdateWasRefit ? "refit " : "rebuild ") << sceneStats.lastUpdateMs << " ms"
+			<< " (refits: " << sceneStats.refitCount << ", rebuilds: " << sceneStats.rebuildCount << ")"
+			<< ", overlap: " << sceneStats.overlap << " (build: " << sceneStats.overlapAtBuild << ")"
+			<< ", SAH cost: " << sceneStats.sahCost << std::endl;
+
+		uint32_t nodeCount{};
+		uint32_t refitCount{};
+		uint32_t rebuildCount{};
+		float updateMs{};
+		float sahCost{};
+		for (const auto& mesh : m_TriangleMeshGeometries)
+		{
+			const BVHStats& meshStats{ mesh.bvh.GetStats() };
+			nodeCount += meshStats.nodeCount;
+			refitCount += meshStats.refitCount;
+			rebuildCount += meshStats.rebuildCount;
+			updateMs += meshStats.lastUpdateMs;
+			sahCost += meshStats.sahCost;
+		}
+
+		//Mesh BVHs only update when their vertices change, so their last update may be many frames old
+		if (!m_TriangleMeshGeometries.empty())
+		{
+			std::cout << "Mesh BVHs: " << nodeCount << " nodes, sum of last updates " << updateMs << " ms"
+				<< " (refits: " << refitCount << ", rebuilds: " << rebuildCount << ")"
+				<< ", avg SAH cost: " << sahCost / m_TriangleMeshGeometries.size() << std::endl;
+		}
 	}
 
 #pragma region Scene Helpers
-	Sphere* Scene::AddSphere(const Vector3& origin, float radius, unsigned char materialIndex)
+	Sphere* Scene::AddSphere(const Vector3& origin, float radius, MaterialIndex materialIndex)
 	{
 		Sphere s;
 		s.origin = origin;
@@ -105,7 +436,17 @@ namespace dae {
 		return &m_SphereGeometries.back();
 	}
 
-	Plane* Scene::AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex)
+	Triangle* Scene::AddTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, TriangleCullMode cullMode, MaterialIndex materialIndex)
+	{
+		Triangle t{ v0, v1, v2 };
+		t.cullMode = cullMode;
+		t.materialIndex = materialIndex;
+
+		m_Triangles.emplace_back(t);
+		return &m_Triangles.back();
+	}
+
+	Plane* Scene::AddPlane(const Vector3& origin, const Vector3& normal, MaterialIndex materialIndex)
 	{
 		Plane p;
 		p.origin = origin;
@@ -116,22 +457,24 @@ namespace dae {
 		return &m_PlaneGeometries.back();
 	}
 
-	TriangleMesh* Scene::AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex)
+	TriangleMesh* Scene::AddTriangleMesh(TriangleCullMode cullMode, MaterialIndex materialIndex)
 	{
 		TriangleMesh m{};
 		m.cullMode = cullMode;
 		m.materialIndex = materialIndex;
+		m.bvh.SetRefitThreshold(m_SceneBVH.GetRefitThreshold());
 
 		m_TriangleMeshGeometries.emplace_back(m);
 		return &m_TriangleMeshGeometries.back();
 	}
 
-	Light* Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color)
+	Light* Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color, float range)
 	{
 		Light l;
 		l.origin = origin;
 		l.intensity = intensity;
 		l.color = color;
+		l.range = range;
 		l.type = LightType::Point;
 
 		m_Lights.emplace_back(l);
@@ -150,10 +493,11 @@ namespace dae {
 		return &m_Lights.back();
 	}
 
-	unsigned char Scene::AddMaterial(Material* pMaterial)
+	MaterialIndex Scene::AddMaterial(const Material& material)
 	{
-		m_Materials.push_back(pMaterial);
-		return static_cast<unsigned char>(m_Materials.size() - 1);
+		assert(m_Materials.size() <= UINT16_MAX && "material indices are 16 bit");
+		m_Materials.push_back(material);
+		return static_cast<MaterialIndex>(m_Materials.size() - 1);
 	}
 #pragma endregion
 #pragma endregion
@@ -162,12 +506,12 @@ namespace dae {
 	void Scene_W1::Initialize()
 	{
 		//default: Material id0 >> SolidColor Material (RED)
-		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
+		constexpr MaterialIndex matId_Solid_Red = 0;
+		const MaterialIndex matId_Solid_Blue = AddMaterial(Material::SolidColor(colors::Blue));
 
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const MaterialIndex matId_Solid_Yellow = AddMaterial(Material::SolidColor(colors::Yellow));
+		const MaterialIndex matId_Solid_Green = AddMaterial(Material::SolidColor(colors::Green));
+		const MaterialIndex matId_Solid_Magenta = AddMaterial(Material::SolidColor(colors::Magenta));
 
 		//Spheres
 		AddSphere({ -25.f, 0.f, 100.f }, 50.f, matId_Solid_Red);
@@ -189,12 +533,12 @@ namespace dae {
 		m_Camera.SetFovAngle(45.f);
 
 		//default: Material id0 >> SolidColor Material (RED)
-		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
+		constexpr MaterialIndex matId_Solid_Red = 0;
+		const MaterialIndex matId_Solid_Blue = AddMaterial(Material::SolidColor(colors::Blue));
 
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const MaterialIndex matId_Solid_Yellow = AddMaterial(Material::SolidColor(colors::Yellow));
+		const MaterialIndex matId_Solid_Green = AddMaterial(Material::SolidColor(colors::Green));
+		const MaterialIndex matId_Solid_Magenta = AddMaterial(Material::SolidColor(colors::Magenta));
 
 		//Plane
 
@@ -231,15 +575,15 @@ namespace dae {
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.SetFovAngle(45.f);
 
-		const unsigned char matCT_GrayRoughMetal = AddMaterial(new Material_CookTorrence({.972f, .960f, .915f}, 1.f, 1.f));
-		const unsigned char matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .6f));
-		const unsigned char matCT_GraySmoothMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .1f));
-		const unsigned char matCT_GrayRoughPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, 1.f));
-		const unsigned char matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, .6f));
-		const unsigned char matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, .1f));
+		const MaterialIndex matCT_GrayRoughMetal = AddMaterial(Material::CookTorrance({.972f, .960f, .915f}, 1.f, 1.f));
+		const MaterialIndex matCT_GrayMediumMetal = AddMaterial(Material::CookTorrance({ .972f, .960f, .915f }, 1.f, .6f));
+		const MaterialIndex matCT_GraySmoothMetal = AddMaterial(Material::CookTorrance({ .972f, .960f, .915f }, 1.f, .1f));
+		const MaterialIndex matCT_GrayRoughPlastic = AddMaterial(Material::CookTorrance({ .75f, .75f, .75f }, 0.f, 1.f));
+		const MaterialIndex matCT_GrayMediumPlastic = AddMaterial(Material::CookTorrance({ .75f, .75f, .75f }, 0.f, .6f));
+		const MaterialIndex matCT_GraySmoothPlastic = AddMaterial(Material::CookTorrance({ .75f, .75f, .75f }, 0.f, .1f));
 
 
-		const unsigned char matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, 0.57f, 0.57f }, 1.f));
+		const MaterialIndex matLambert_GrayBlue = AddMaterial(Material::Lambert({ .49f, 0.57f, 0.57f }, 1.f));
 
 		//Plane 
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue); //Back
@@ -270,8 +614,8 @@ namespace dae {
 		m_Camera.origin = { 0.f, 1.f, -5.f };
 		m_Camera.SetFovAngle(45.f);
 
-		const unsigned char matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, .57f, 0.57f }, 1.f));
-		const unsigned char matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const MaterialIndex matLambert_GrayBlue = AddMaterial(Material::Lambert({ .49f, .57f, 0.57f }, 1.f));
+		const MaterialIndex matLambert_White = AddMaterial(Material::Lambert(colors::White, 1.f));
 		
 
 		//Plane 
@@ -283,10 +627,7 @@ namespace dae {
 
 
 		//triangle temp
-		auto triangle = Triangle{ {-0.75f, 0.5f, 0.f}, {-0.75, 2.f, 0.f}, {.75f, .5f, 0.f } };
-		triangle.cullMode = TriangleCullMode::NoCulling;
-		triangle.materialIndex = matLambert_White;
-		m_Triangles.emplace_back(triangle);
+		AddTriangle({ -0.75f, 0.5f, 0.f }, { -0.75, 2.f, 0.f }, { .75f, .5f, 0.f }, TriangleCullMode::NoCulling, matLambert_White);
 
 
 		//Triangle Mesh
@@ -297,7 +638,7 @@ namespace dae {
 		//	0,2,3  // Triangle 2
 		//};
 
-		Utils::ParseOBJ("Resources/simple_cube.obj", m_pMesh->positions, m_pMesh->normals, m_pMesh->indices);
+		Utils::LoadMesh("Resources/simple_cube.obj", *m_pMesh);
 
 
 		m_pMesh->Scale({ .7f, .7f, .7f });
@@ -329,15 +670,15 @@ namespace dae {
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.SetFovAngle(45.f);
 
-		const unsigned char matCT_GrayRoughMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, 1.f));
-		const unsigned char matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .6f));
-		const unsigned char matCT_GraySmoothMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .1f));
-		const unsigned char matCT_GrayRoughPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, 1.f));
-		const unsigned char matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, .6f));
-		const unsigned char matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, .1f));
+		const MaterialIndex matCT_GrayRoughMetal = AddMaterial(Material::CookTorrance({ .972f, .960f, .915f }, 1.f, 1.f));
+		const MaterialIndex matCT_GrayMediumMetal = AddMaterial(Material::CookTorrance({ .972f, .960f, .915f }, 1.f, .6f));
+		const MaterialIndex matCT_GraySmoothMetal = AddMaterial(Material::CookTorrance({ .972f, .960f, .915f }, 1.f, .1f));
+		const MaterialIndex matCT_GrayRoughPlastic = AddMaterial(Material::CookTorrance({ .75f, .75f, .75f }, 0.f, 1.f));
+		const MaterialIndex matCT_GrayMediumPlastic = AddMaterial(Material::CookTorrance({ .75f, .75f, .75f }, 0.f, .6f));
+		const MaterialIndex matCT_GraySmoothPlastic = AddMaterial(Material::CookTorrance({ .75f, .75f, .75f }, 0.f, .1f));
 
-		const unsigned char matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, 0.57f, 0.57f }, 1.f));
-		const unsigned char matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const MaterialIndex matLambert_GrayBlue = AddMaterial(Material::Lambert({ .49f, 0.57f, 0.57f }, 1.f));
+		const MaterialIndex matLambert_White = AddMaterial(Material::Lambert(colors::White, 1.f));
 
 
 		//Plane 
@@ -403,8 +744,8 @@ namespace dae {
 		m_Camera.SetFovAngle( 45.f);
 
 
-		const unsigned char matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, 0.57f, 0.57f }, 1.f));
-		const unsigned char matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const MaterialIndex matLambert_GrayBlue = AddMaterial(Material::Lambert({ .49f, 0.57f, 0.57f }, 1.f));
+		const MaterialIndex matLambert_White = AddMaterial(Material::Lambert(colors::White, 1.f));
 
 
 		//Plane 
@@ -416,7 +757,7 @@ namespace dae {
 
 
 		m_pMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
-		Utils::ParseOBJ("Resources/lowpoly_bunny.obj", m_pMesh->positions, m_pMesh->normals, m_pMesh->indices);
+		Utils::LoadMesh("Resources/lowpoly_bunny.obj", *m_pMesh);
 
 
 		m_pMesh->Scale({ 2.f, 2.f, 2.f });
@@ -442,4 +783,103 @@ namespace dae {
 		m_pMesh->UpdateTransforms();
 	}
 
+	void Scene_W4_DeformScene::Initialize()
+	{
+		sceneName = "Deforming Mesh Scene";
+		m_Camera.origin = { 0.f, 3.f, -9.f };
+		m_Camera.SetFovAngle(45.f);
+
+		const MaterialIndex matLambert_GrayBlue = AddMaterial(Material::Lambert({ .49f, 0.57f, 0.57f }, 1.f));
+		const MaterialIndex matCT_GrayMediumPlastic = AddMaterial(Material::CookTorrance({ .75f, .75f, .75f }, 0.f, .6f));
+
+		//Plane
+		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue); //Back
+		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, matLambert_GrayBlue); //Bottom
+		AddPlane({ 0.f, 10.f, 0.f }, { 0.f, -1.f, 0.f }, matLambert_GrayBlue); //Top
+		AddPlane({ 5.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, matLambert_GrayBlue); //Right
+		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, matLambert_GrayBlue);	//Left
+
+		//Square grid in the XY plane, facing the camera
+		m_pMesh = AddTriangleMesh(TriangleCullMode::NoCulling, matCT_GrayMediumPlastic);
+
+		constexpr int verticesPerSide{ gridResolution + 1 };
+		m_RestPositions.reserve(verticesPerSide * verticesPerSide);
+		for (int y = 0; y < verticesPerSide; ++y)
+		{
+			for (int x = 0; x < verticesPerSide; ++x)
+			{
+				m_RestPositions.emplace_back(
+					(2.f * x / gridResolution - 1.f) * gridHalfSize,
+					(2.f * y / gridResolution - 1.f) * gridHalfSize,
+					0.f);
+			}
+		}
+
+		m_pMesh->indices.reserve(gridResolution * gridResolution * 6);
+		for (int y = 0; y < gridResolution; ++y)
+		{
+			for (int x = 0; x < gridResolution; ++x)
+			{
+				const int bottomLeft{ x + y * verticesPerSide };
+				const int bottomRight{ bottomLeft + 1 };
+				const int topLeft{ bottomLeft + verticesPerSide };
+				const int topRight{ topLeft + 1 };
+
+				m_pMesh->indices.insert(m_pMesh->indices.end(), { bottomLeft, topLeft, bottomRight, bottomRight, topLeft, topRight });
+			}
+		}
+
+		m_pMesh->positions = m_RestPositions;
+		m_pMesh->CalculateNormals();
+		m_pMesh->Translate({ 0.f, 3.f, 2.f });
+		m_pMesh->UpdateTransforms();
+
+		//Light
+		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, { 1.f, .61f, .45f }); //BackLight
+		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, { 1.f, .8f, .45f }); //Front Light Left
+		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, { .34f, .47f, .68f });
+	}
+
+	void Scene_W4_DeformScene::Update(Timer* pTimer)
+	{
+		Scene::Update(pTimer);
+
+		//Twist around the center (strongest there, none at the edge) plus a ripple running outwards
+		//The twist drags triangles of a leaf apart along arcs, so refits keep degrading the tree until it's rebuilt
+		const float time{ pTimer->GetTotal() };
+		const float twist{ sinf(time * .5f) * PI };
+
+		for (size_t i = 0; i < m_RestPositions.size(); ++i)
+		{
+			const Vector3& rest{ m_RestPositions[i] };
+			const float radius{ sqrtf(rest.x * rest.x + rest.y * rest.y) };
+			const float angle{ twist * std::max(1.f - radius / gridHalfSize, 0.f) };
+			const float cosAngle{ cosf(angle) };
+			const float sinAngle{ sinf(angle) };
+
+			m_pMesh->positions[i] = {
+				rest.x * cosAngle - rest.y * sinAngle,
+				rest.x * sinAngle + rest.y * cosAngle,
+				.25f * sinf(radius * 3.f - time * 2.f) };
+		}
+
+		m_pMesh->MarkPositionsDirty();
+		m_pMesh->UpdateTransforms();
+	}
+
+#pragma region Scene Factory
+	Scene* CreateScene(const std::string& sceneName)
+	{
+		if (sceneName == "w1") return new Scene_W1();
+		if (sceneName == "w2") return new Scene_W2();
+		if (sceneName == "w3") return new Scene_W3();
+		if (sceneName == "test") return new Scene_W4_TestScene();
+		if (sceneName == "reference") return new Scene_W4_ReferenceScene();
+		if (sceneName == "bunny") return new Scene_W4_BunnyScene();
+		if (sceneName == "deform") return new Scene_W4_DeformScene();
+		if (sceneName.ends_with(".scene") && std::filesystem::exists(sceneName)) return new Scene_File(sceneName);
+		return nullptr;
+	}
+#pragma endregion
+
 }
@@ -1,16 +1,18 @@
 #pragma once
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "Math.h"
 #include "DataTypes.h"
 #include "Camera.h"
+#include "LightBVH.h"
+#include "Material.h"
 
 namespace dae
 {
 	//Forward Declarations
 	class Timer;
-	class Material;
 	struct Plane;
 	struct Sphere;
 	struct Light;
@@ -34,13 +36,50 @@ namespace dae
 		}
 
 		Camera& GetCamera() { return m_Camera; }
+		const std::string& GetSceneName() const { return sceneName; }
 		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
-		bool DoesHit(const Ray& ray) const;
+		//Same result as GetClosestHit for each of the 4 rays, traced together as one SSE packet
+		void GetClosestHit4(const Ray (&rays)[4], HitRecord (&closestHits)[4]) const;
+
+		static constexpr uint32_t noOccluder{ UINT32_MAX };
+		/**
+		 * \brief Any hit between ray.min and ray.max (shadow rays), stops at the first one and computes nothing about it
+		 * \param lastOccluderIdx primitive that blocked the previous ray of the same light (or noOccluder), it's tested before anything else and
+		 * replaced by whatever blocks this ray, neighbouring shadow rays towards one light tend to share their occluder
+		 */
+		bool IsOccluded(const Ray& ray, uint32_t& lastOccluderIdx) const;
+
+		//Rebuilds the scene hierarchy over all bounded primitives, call after anything moved
+		//Cheap when nothing changed: the hierarchy is only rebuilt when a primitive's bounds differ
+		//The light hierarchy is (re)built here too, whenever a light was added, removed or changed
+		void UpdateSceneBVH();
+		//Incremented by UpdateSceneBVH whenever a primitive's bounds, a mesh transform or geometry or a light changed since its previous call
+		uint64_t GetVersion() const { return m_Version; }
+
+		//Switches all meshes between BVH traversal and the linear triangle loop
+		void ToggleBVH();
+		//Switches between refitting and fully rebuilding the BVHs when primitives move
+		void ToggleBVHRefit();
+		bool IsBVHRefitEnabled() const { return m_SceneBVH.IsRefitEnabled(); }
+		//How much the overlap of the scene and mesh BVHs may grow through refits before they're rebuilt, see BVH::SetRefitThreshold
+		void SetBVHRefitThreshold(float maxOverlapIncrease);
+		float GetBVHRefitThreshold() const { return m_SceneBVH.GetRefitThreshold(); }
+		//Switches the scene and mesh BVHs between 4-wide SIMD nodes and the binary layout
+		void ToggleWideBVH();
+		bool IsWideBVHEnabled() const { return m_SceneBVH.IsWideNodesEnabled(); }
+		//Rebuilds all mesh BVHs with the next builder: SweepSAH -> BinnedSAH -> LBVH
+		void CycleMeshBVHBuilder();
+		const char* GetMeshBVHBuilderName() const;
+		//Update time, overlap and expected traversal cost (SAH) of the scene and mesh BVHs
+		void PrintBVHStats() const;
+		bool IsBVHEnabled() const { return m_BVHEnabled; }
 
 		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
 		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
+		const std::vector<Triangle>& GetTriangles() const { return m_Triangles; }
 		const std::vector<Light>& GetLights() const { return m_Lights; }
-		const std::vector<Material*> GetMaterials() const { return m_Materials; }
+		const LightBVH& GetLightBVH() const { return m_LightBVH; }
+		const std::vector<Material>& GetMaterials() const { return m_Materials; }
 
 	protected:
 		std::string	sceneName;
@@ -52,17 +91,56 @@ namespace dae
 
 		std::vector<TriangleMesh> m_TriangleMeshGeometries{};
 		std::vector<Light> m_Lights{};
-		std::vector<Material*> m_Materials{};
+		std::vector<Material> m_Materials{};
 
 		Camera m_Camera{};
 
-		Sphere* AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
-		Plane* AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
-		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex = 0);
+		//Scene hierarchy over spheres, standalone triangles and mesh instances (each mesh holds its own bottom level BVH)
+		//Infinite planes can't be bounded and are tested separately
+		enum class ScenePrimitiveType : uint8_t
+		{
+			Sphere,
+			Triangle,
+			TriangleMesh
+		};
 
-		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
+		struct ScenePrimitive
+		{
+			ScenePrimitiveType type{};
+			uint32_t index{}; //Index in the matching geometry vector
+		};
+
+		BVH m_SceneBVH{};
+		std::vector<ScenePrimitive> m_ScenePrimitives{};
+		std::vector<Vector3> m_PrimitiveMinAABBs{};
+		std::vector<Vector3> m_PrimitiveMaxAABBs{};
+		std::vector<Vector3> m_BuiltMinAABBs{};
+		std::vector<Vector3> m_BuiltMaxAABBs{};
+		std::vector<Matrix> m_LastMeshTransforms{}; //A rotation can leave the bounds untouched
+		std::vector<uint64_t> m_LastMeshGeometryVersions{}; //So can a deformation, see TriangleMesh::geometryVersion
+		std::vector<Light> m_LastLights{}; //What m_LightBVH was built from, subclasses may move or recolor lights in Update
+		uint64_t m_Version{};
+
+		LightBVH m_LightBVH{};
+
+		//Only lowers t (and sets triangleIdx for meshes) when the primitive is hit closer than t
+		bool HitTest_ScenePrimitive(const ScenePrimitive& primitive, const Ray& ray, float& t, uint32_t& triangleIdx) const;
+		//Any hit on the primitive (ids as in SetHitRecord, planes included) within the ray's range
+		bool Occludes(uint32_t primitiveIdx, const Ray& ray) const;
+		//Surface data of the closest hit, computed once after traversal, primitiveIdx past m_ScenePrimitives are the planes
+		void SetHitRecord(uint32_t primitiveIdx, uint32_t triangleIdx, const Ray& ray, float t, HitRecord& hitRecord) const;
+
+		bool m_BVHEnabled{ true };
+		BVHBuilder m_MeshBVHBuilder{ BVHBuilder::BinnedSAH };
+
+		Sphere* AddSphere(const Vector3& origin, float radius, MaterialIndex materialIndex = 0);
+		Triangle* AddTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, TriangleCullMode cullMode, MaterialIndex materialIndex = 0);
+		Plane* AddPlane(const Vector3& origin, const Vector3& normal, MaterialIndex materialIndex = 0);
+		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, MaterialIndex materialIndex = 0);
+
+		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color, float range = 0.f);
 		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
-		unsigned char AddMaterial(Material* pMaterial);
+		MaterialIndex AddMaterial(const Material& material);
 	};
 
 	//+++++++++++++++++++++++++++++++++++++++++
@@ -173,4 +251,75 @@ namespace dae
 	private:
 		TriangleMesh* m_pMesh{ nullptr };
 	};
+
+	//+++++++++++++++++++++++++++++++++++++++++
+//WEEK 4 Deforming Mesh Scene
+	//A grid mesh whose vertices twist and ripple every frame, its BVH is refit (and rebuilt past the refit threshold) each update
+	class Scene_W4_DeformScene final : public Scene
+	{
+	public:
+		Scene_W4_DeformScene() = default;
+		~Scene_W4_DeformScene() override = default;
+
+		Scene_W4_DeformScene(const Scene_W4_DeformScene&) = delete;
+		Scene_W4_DeformScene(Scene_W4_DeformScene&&) noexcept = delete;
+		Scene_W4_DeformScene& operator=(const Scene_W4_DeformScene&) = delete;
+		Scene_W4_DeformScene& operator=(Scene_W4_DeformScene&&) noexcept = delete;
+
+		void Initialize() override;
+		void Update(Timer* pTimer) override;
+
+	private:
+		static constexpr int gridResolution{ 96 }; //Quads per side
+		static constexpr float gridHalfSize{ 2.5f };
+
+		TriangleMesh* m_pMesh{ nullptr };
+		std::vector<Vector3> m_RestPositions{};
+	};
+
+	//+++++++++++++++++++++++++++++++++++++++++
+//Scene File
+	//Scene described by a text file instead of code, the format is documented in Resources/reference.scene
+	//Every line goes through the Add* helpers, meshes are loaded concurrently once the whole file is read
+	class Scene_File final : public Scene
+	{
+	public:
+		explicit Scene_File(const std::string& path);
+		~Scene_File() override = default;
+
+		Scene_File(const Scene_File&) = delete;
+		Scene_File(Scene_File&&) noexcept = delete;
+		Scene_File& operator=(const Scene_File&) = delete;
+		Scene_File& operator=(Scene_File&&) noexcept = delete;
+
+		void Initialize() override;
+
+	private:
+		struct MeshDescription
+		{
+			std::string path{};
+			TriangleCullMode cullMode{ TriangleCullMode::BackFaceCulling };
+			MaterialIndex materialIndex{};
+			Vector3 scale{ 1.f, 1.f, 1.f };
+			float yaw{}; //Radians
+			Vector3 translation{};
+			bool slabTestOn{ true };
+			int lineNumber{};
+		};
+
+		std::string m_Path{};
+		std::unordered_map<std::string, MaterialIndex> m_MaterialIndices{};
+		std::vector<MeshDescription> m_PendingMeshes{};
+
+		//Adds what one line describes, false + error when it's malformed
+		bool ParseLine(const std::vector<std::string>& tokens, int lineNumber, std::string& error);
+		void LoadPendingMeshes();
+	};
+
+	//Short names of the built-in scenes above, in week order
+	inline constexpr const char* builtInSceneNames[]{ "w1", "w2", "w3", "test", "reference", "bunny", "deform" };
+
+	//Creates one of the built-in scenes by short name (see builtInSceneNames) or a Scene_File from a path ending in .scene
+	//nullptr for an unknown name or a scene file that doesn't exist
+	Scene* CreateScene(const std::string& sceneName);
 }
@@ -0,0 +1,454 @@
+#include "Scene.h"
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+
+#include "Material.h"
+#include "MeshLoader.h"
+
+namespace dae {
+
+	namespace
+	{
+		//Values following each key, names, paths and modes count as one value
+		const std::unordered_map<std::string, int> sceneFileKeyArity{
+			{ "origin", 3 }, { "normal", 3 }, { "direction", 3 }, { "color", 3 }, { "albedo", 3 },
+			{ "v0", 3 }, { "v1", 3 }, { "v2", 3 }, { "scale", 3 }, { "translate", 3 },
+			{ "fov", 1 }, { "yaw", 1 }, { "pitch", 1 }, { "radius", 1 }, { "intensity", 1 },
+			{ "kd", 1 }, { "ks", 1 }, { "exponent", 1 }, { "metalness", 1 }, { "roughness", 1 }, { "rotate_y", 1 }, { "range", 1 },
+			{ "material", 1 }, { "cull", 1 }, { "file", 1 }, { "slabtest", 1 }
+		};
+
+		//The "key values key values ..." part of a line, the first error sticks and makes every later getter a no-op
+		class SceneFileLine final
+		{
+		public:
+			SceneFileLine(const std::vector<std::string>& tokens, size_t firstKey, std::initializer_list<const char*> allowedKeys)
+			{
+				for (size_t tokenIdx{ firstKey }; tokenIdx < tokens.size() && m_Error.empty();)
+				{
+					const std::string& key{ tokens[tokenIdx] };
+					const auto arityIt{ sceneFileKeyArity.find(key) };
+
+					if (arityIt == sceneFileKeyArity.end() || std::none_of(allowedKeys.begin(), allowedKeys.end(), [&key](const char* allowed) { return key == allowed; }))
+					{
+						m_Error = "unexpected key '" + key + "'";
+						break;
+					}
+
+					if (tokenIdx + arityIt->second >= tokens.size())
+					{
+						m_Error = "'" + key + "' needs " + std::to_string(arityIt->second) + " value(s)";
+						break;
+					}
+
+					m_Values[key].assign(tokens.begin() + tokenIdx + 1, tokens.begin() + tokenIdx + 1 + arityIt->second);
+					tokenIdx += arityIt->second + 1;
+				}
+			}
+
+			const std::string& GetError() const { return m_Error; }
+			bool Has(const std::string& key) const { return m_Values.contains(key); }
+
+			float GetFloat(const std::string& key, float defaultValue)
+			{
+				const auto it{ m_Values.find(key) };
+				return it == m_Values.end() ? defaultValue : ToFloat(key, it->second[0]);
+			}
+
+			Vector3 GetVector3(const std::string& key, const Vector3& defaultValue)
+			{
+				const auto it{ m_Values.find(key) };
+				if (it == m_Values.end())
+					return defaultValue;
+
+				return Vector3{ ToFloat(key, it->second[0]), ToFloat(key, it->second[1]), ToFloat(key, it->second[2]) };
+			}
+
+			ColorRGB GetColor(const std::string& key, const ColorRGB& defaultValue)
+			{
+				const Vector3 color{ GetVector3(key, { defaultValue.r, defaultValue.g, defaultValue.b }) };
+				return ColorRGB{ color.x, color.y, color.z };
+			}
+
+			std::string GetString(const std::string& key, const std::string& defaultValue) const
+			{
+				const auto it{ m_Values.find(key) };
+				return it == m_Values.end() ? defaultValue : it->second[0];
+			}
+
+			void SetError(const std::string& error)
+			{
+				if (m_Error.empty())
+					m_Error = error;
+			}
+
+		private:
+			std::unordered_map<std::string, std::vector<std::string>> m_Values{};
+			std::string m_Error{};
+
+			float ToFloat(const std::string& key, const std::string& token)
+			{
+				const char* pBegin{ token.data() + (token.starts_with('+') ? 1 : 0) };
+				const char* pEnd{ token.data() + token.size() };
+
+				float value{};
+				const auto [pNext, error] { std::from_chars(pBegin, pEnd, value) };
+				if (error != std::errc{} || pNext != pEnd)
+					SetError("'" + token + "' is not a number (" + key + ")");
+
+				return value;
+			}
+		};
+
+		bool ParseCullMode(const std::string& name, TriangleCullMode& cullMode)
+		{
+			if (name == "back")
+				cullMode = TriangleCullMode::BackFaceCulling;
+			else if (name == "front")
+				cullMode = TriangleCullMode::FrontFaceCulling;
+			else if (name == "none")
+				cullMode = TriangleCullMode::NoCulling;
+			else
+				return false;
+
+			return true;
+		}
+	}
+
+	Scene_File::Scene_File(const std::string& path)
+		: m_Path{ path }
+	{
+		//Material 0 is the default solid red one every scene starts with
+		m_MaterialIndices["default"] = 0;
+	}
+
+	void Scene_File::Initialize()
+	{
+		sceneName = std::filesystem::path{ m_Path }.stem().string();
+
+		std::ifstream file{ m_Path };
+		if (!file)
+		{
+			std::cout << "Could not open scene file " << m_Path << std::endl;
+			return;
+		}
+
+		std::string line{};
+		int lineNumber{};
+
+		while (std::getline(file, line))
+		{
+			++lineNumber;
+
+			const size_t commentStart{ line.find('#') };
+			std::istringstream lineStream{ line.substr(0, commentStart) };
+
+			std::vector<std::string> tokens{};
+			for (std::string token; lineStream >> token;)
+			{
+				tokens.push_back(std::move(token));
+			}
+
+			if (tokens.empty())
+				continue;
+
+			//A bad line is reported and skipped, the rest of the scene still loads
+			std::string error{};
+			if (!ParseLine(tokens, lineNumber, error))
+				std::cout << m_Path << ":" << lineNumber << ": " << error << std::endl;
+		}
+
+		LoadPendingMeshes();
+	}
+
+	bool Scene_File::ParseLine(const std::vector<std::string>& tokens, int lineNumber, std::string& error)
+	{
+		const std::string& type{ tokens[0] };
+
+		const auto getMaterial = [this](SceneFileLine& line)
+		{
+			const std::string name{ line.GetString("material", "default") };
+			const auto it{ m_MaterialIndices.find(name) };
+			if (it != m_MaterialIndices.end())
+				return it->second;
+
+			line.SetError("unknown material '" + name + "'");
+			return MaterialIndex{ 0 };
+		};
+
+		const auto getCullMode = [](SceneFileLine& line, TriangleCullMode defaultMode)
+		{
+			TriangleCullMode cullMode{ defaultMode };
+			if (line.Has("cull") && !ParseCullMode(line.GetString("cull", ""), cullMode))
+				line.SetError("cull is one of back, front, none");
+			return cullMode;
+		};
+
+		if (type == "name")
+		{
+			std::string name{};
+			for (size_t tokenIdx{ 1 }; tokenIdx < tokens.size(); ++tokenIdx)
+			{
+				name += (tokenIdx > 1 ? " " : "") + tokens[tokenIdx];
+			}
+
+			sceneName = name;
+			return true;
+		}
+
+		if (type == "camera")
+		{
+			SceneFileLine line{ tokens, 1, { "origin", "fov", "yaw", "pitch" } };
+			const Vector3 origin{ line.GetVector3("origin", m_Camera.origin) };
+			const float fov{ line.GetFloat("fov", 90.f) };
+			const float yaw{ line.GetFloat("yaw", 0.f) };
+			const float pitch{ line.GetFloat("pitch", 0.f) };
+
+			error = line.GetError();
+			if (!error.empty())
+				return false;
+
+			m_Camera.origin = origin;
+			m_Camera.SetFovAngle(fov);
+			m_Camera.totalYaw = yaw * TO_RADIANS;
+			m_Camera.totalPitch = pitch * TO_RADIANS;
+			return true;
+		}
+
+		if (type == "material")
+		{
+			if (tokens.size() < 3)
+			{
+				error = "expected: material <name> solid|lambert|lambertphong|cooktorrance ...";
+				return false;
+			}
+
+			const std::string& name{ tokens[1] };
+			const std::string& model{ tokens[2] };
+
+			if (m_MaterialIndices.contains(name))
+			{
+				error = "material '" + name + "' already exists";
+				return false;
+			}
+
+			if (m_Materials.size() > UINT16_MAX)
+			{
+				error = "too many materials, material indices are 16 bit";
+				return false;
+			}
+
+			Material material{};
+
+			if (model == "solid")
+			{
+				SceneFileLine line{ tokens, 3, { "color" } };
+				const ColorRGB color{ line.GetColor("color", colors::White) };
+				error = line.GetError();
+				if (error.empty())
+					material = Material::SolidColor(color);
+			}
+			else if (model == "lambert")
+			{
+				SceneFileLine line{ tokens, 3, { "color", "kd" } };
+				const ColorRGB color{ line.GetColor("color", colors::White) };
+				const float kd{ line.GetFloat("kd", 1.f) };
+				error = line.GetError();
+				if (error.empty())
+					material = Material::Lambert(color, kd);
+			}
+			else if (model == "lambertphong")
+			{
+				SceneFileLine line{ tokens, 3, { "color", "kd", "ks", "exponent" } };
+				const ColorRGB color{ line.GetColor("color", colors::White) };
+				const float kd{ line.GetFloat("kd", .5f) };
+				const float ks{ line.GetFloat("ks", .5f) };
+				const float exponent{ line.GetFloat("exponent", 1.f) };
+				error = line.GetError();
+				if (error.empty())
+					material = Material::LambertPhong(color, kd, ks, exponent);
+			}
+			else if (model == "cooktorrance")
+			{
+				SceneFileLine line{ tokens, 3, { "albedo", "metalness", "roughness" } };
+				const ColorRGB albedo{ line.GetColor("albedo", { .955f, .637f, .538f }) };
+				const float metalness{ line.GetFloat("metalness", 1.f) };
+				const float roughness{ line.GetFloat("roughness", .1f) };
+				error = line.GetError();
+				if (error.empty())
+					material = Material::CookTorrance(albedo, metalness, roughness);
+			}
+			else
+			{
+				error = "unknown material model '" + model + "'";
+			}
+
+			if (!error.empty())
+				return false;
+
+			m_MaterialIndices[name] = AddMaterial(material);
+			return true;
+		}
+
+		if (type == "sphere")
+		{
+			SceneFileLine line{ tokens, 1, { "origin", "radius", "material" } };
+			const Vector3 origin{ line.GetVector3("origin", {}) };
+			const float radius{ line.GetFloat("radius", 1.f) };
+			const MaterialIndex materialIndex{ getMaterial(line) };
+
+			error = line.GetError();
+			if (!error.empty())
+				return false;
+
+			AddSphere(origin, radius, materialIndex);
+			return true;
+		}
+
+		if (type == "plane")
+		{
+			SceneFileLine line{ tokens, 1, { "origin", "normal", "material" } };
+			const Vector3 origin{ line.GetVector3("origin", {}) };
+			const Vector3 normal{ line.GetVector3("normal", Vector3::UnitY) };
+			const MaterialIndex materialIndex{ getMaterial(line) };
+
+			error = line.GetError();
+			if (!error.empty())
+				return false;
+
+			AddPlane(origin, normal.Normalized(), materialIndex);
+			return true;
+		}
+
+		if (type == "triangle")
+		{
+			SceneFileLine line{ tokens, 1, { "v0", "v1", "v2", "cull", "material" } };
+			const Vector3 v0{ line.GetVector3("v0", {}) };
+			const Vector3 v1{ line.GetVector3("v1", {}) };
+			const Vector3 v2{ line.GetVector3("v2", {}) };
+			const TriangleCullMode cullMode{ getCullMode(line, TriangleCullMode::NoCulling) };
+			const MaterialIndex materialIndex{ getMaterial(line) };
+
+			error = line.GetError();
+			if (!error.empty())
+				return false;
+
+			AddTriangle(v0, v1, v2, cullMode, materialIndex);
+			return true;
+		}
+
+		if (type == "mesh")
+		{
+			SceneFileLine line{ tokens, 1, { "file", "cull", "material", "scale", "rotate_y", "translate", "slabtest" } };
+
+			MeshDescription mesh{};
+			mesh.lineNumber = lineNumber;
+			mesh.cullMode = getCullMode(line, TriangleCullMode::BackFaceCulling);
+			mesh.materialIndex = getMaterial(line);
+			mesh.scale = line.GetVector3("scale", mesh.scale);
+			mesh.yaw = line.GetFloat("rotate_y", 0.f) * TO_RADIANS;
+			mesh.translation = line.GetVector3("translate", {});
+			mesh.slabTestOn = line.GetString("slabtest", "on") != "off";
+
+			if (!line.Has("file"))
+				line.SetError("mesh needs a file");
+			if (mesh.scale.x == 0.f || mesh.scale.y == 0.f || mesh.scale.z == 0.f)
+				line.SetError("a mesh scale can't be zero");
+
+			error = line.GetError();
+			if (!error.empty())
+				return false;
+
+			//Relative to the scene file, so scenes can be moved together with their assets
+			mesh.path = (std::filesystem::path{ m_Path }.parent_path() / line.GetString("file", "")).string();
+			m_PendingMeshes.push_back(mesh);
+			return true;
+		}
+
+		if (type == "pointlight" || type == "directionallight")
+		{
+			const bool isPoint{ type == "pointlight" };
+			SceneFileLine line{ tokens, 1, { isPoint ? "origin" : "direction", "intensity", "color", "range" } };
+			const Vector3 vector{ line.GetVector3(isPoint ? "origin" : "direction", isPoint ? Vector3{} : -Vector3::UnitY) };
+			const float intensity{ line.GetFloat("intensity", 1.f) };
+			const ColorRGB color{ line.GetColor("color", colors::White) };
+			const float range{ line.GetFloat("range", 0.f) };
+			if (!isPoint && line.Has("range"))
+				line.SetError("directional lights can't have a range");
+
+			error = line.GetError();
+			if (!error.empty())
+				return false;
+
+			if (isPoint)
+				AddPointLight(vector, intensity, color, range);
+			else
+				AddDirectionalLight(vector.Normalized(), intensity, color);
+			return true;
+		}
+
+		error = "unknown line type '" + type + "'";
+		return false;
+	}
+
+	void Scene_File::LoadPendingMeshes()
+	{
+		//All meshes are added before any pointer is taken, growing the vector would move them
+		const size_t firstMeshIdx{ m_TriangleMeshGeometries.size() };
+		for (const MeshDescription& description : m_PendingMeshes)
+		{
+			AddTriangleMesh(description.cullMode, description.materialIndex);
+		}
+
+		//One task per mesh, every mesh is independent: parse (or cache read), BVH build and transforms
+		std::vector<std::future<bool>> loadTasks{};
+		loadTasks.reserve(m_PendingMeshes.size());
+
+		for (size_t meshIdx{}; meshIdx < m_PendingMeshes.size(); ++meshIdx)
+		{
+			TriangleMesh& mesh{ m_TriangleMeshGeometries[firstMeshIdx + meshIdx] };
+			const MeshDescription& description{ m_PendingMeshes[meshIdx] };
+
+			loadTasks.emplace_back(std::async(std::launch::async, [&mesh, &description]
+				{
+					//A failed load can leave partial data behind, the mesh is removed below without ever building it
+					if (!Utils::LoadMesh(description.path, mesh))
+						return false;
+
+					mesh.Scale(description.scale);
+					mesh.RotateY(description.yaw);
+					mesh.Translate(description.translation);
+					mesh.slabTestOn = description.slabTestOn;
+					mesh.UpdateTransforms();
+
+					return true;
+				}));
+		}
+
+		std::vector<bool> isLoaded(loadTasks.size());
+		for (size_t meshIdx{}; meshIdx < loadTasks.size(); ++meshIdx)
+		{
+			isLoaded[meshIdx] = loadTasks[meshIdx].get();
+			if (!isLoaded[meshIdx])
+			{
+				const MeshDescription& description{ m_PendingMeshes[meshIdx] };
+				std::cout << m_Path << ":" << description.lineNumber << ": could not load mesh " << description.path << std::endl;
+			}
+		}
+
+		//A mesh that can't be loaded is skipped like any other bad line, back to front so the remaining indices stay valid
+		for (size_t meshIdx{ loadTasks.size() }; meshIdx-- > 0;)
+		{
+			if (!isLoaded[meshIdx])
+				m_TriangleMeshGeometries.erase(m_TriangleMeshGeometries.begin() + firstMeshIdx + meshIdx);
+		}
+
+		m_PendingMeshes.clear();
+	}
+}
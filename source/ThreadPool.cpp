@@ -0,0 +1,157 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace dae {
+
+	ThreadPool::ThreadPool(uint32_t threadCount)
+		: m_ThreadCount{ std::max(threadCount, 1u) }
+		, m_Ranges{ std::make_unique<TaskRange[]>(m_ThreadCount) }
+	{
+		m_Workers.reserve(m_ThreadCount - 1);
+
+		for (uint32_t threadIdx{ 1 }; threadIdx < m_ThreadCount; ++threadIdx)
+		{
+			m_Workers.emplace_back(&ThreadPool::WorkerLoop, this, threadIdx);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard lock{ m_Mutex };
+			m_IsStopping = true;
+		}
+		m_StartCondition.notify_all();
+
+		for (std::thread& worker : m_Workers)
+		{
+			worker.join();
+		}
+	}
+
+	void ThreadPool::ParallelFor(uint32_t taskCount, const std::function<void(uint32_t taskIdx, uint32_t threadIdx)>& task)
+	{
+		if (taskCount == 0)
+			return;
+
+		if (m_Workers.empty() || taskCount == 1)
+		{
+			for (uint32_t taskIdx{}; taskIdx < taskCount; ++taskIdx)
+			{
+				task(taskIdx, 0);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard lock{ m_Mutex };
+			assert(m_BusyWorkers == 0 && "ThreadPool::ParallelFor is not reentrant");
+
+			//Consecutive ranges keep neighbouring tasks (tiles) on the same thread as long as nothing gets stolen
+			for (uint32_t threadIdx{}; threadIdx < m_ThreadCount; ++threadIdx)
+			{
+				const uint32_t begin{ static_cast<uint32_t>(static_cast<uint64_t>(taskCount) * threadIdx / m_ThreadCount) };
+				const uint32_t end{ static_cast<uint32_t>(static_cast<uint64_t>(taskCount) * (threadIdx + 1) / m_ThreadCount) };
+				m_Ranges[threadIdx].range.store(PackRange(begin, end), std::memory_order_relaxed);
+			}
+
+			m_pTask = &task;
+			m_BusyWorkers = static_cast<uint32_t>(m_Workers.size());
+			++m_JobId;
+		}
+		m_StartCondition.notify_all();
+
+		RunTasks(0);
+
+		std::unique_lock lock{ m_Mutex };
+		m_DoneCondition.wait(lock, [this] { return m_BusyWorkers == 0; });
+		m_pTask = nullptr;
+	}
+
+	void ThreadPool::WorkerLoop(uint32_t threadIdx)
+	{
+		uint64_t lastJobId{};
+
+		while (true)
+		{
+			{
+				std::unique_lock lock{ m_Mutex };
+				m_StartCondition.wait(lock, [&] { return m_IsStopping || m_JobId != lastJobId; });
+
+				if (m_IsStopping)
+					return;
+
+				lastJobId = m_JobId;
+			}
+
+			RunTasks(threadIdx);
+
+			{
+				std::lock_guard lock{ m_Mutex };
+				--m_BusyWorkers;
+			}
+			m_DoneCondition.notify_one();
+		}
+	}
+
+	void ThreadPool::RunTasks(uint32_t threadIdx)
+	{
+		const std::function<void(uint32_t, uint32_t)>& task{ *m_pTask };
+
+		uint32_t taskIdx{};
+		while (PopTask(threadIdx, taskIdx) || StealTask(threadIdx, taskIdx))
+		{
+			task(taskIdx, threadIdx);
+		}
+	}
+
+	bool ThreadPool::PopTask(uint32_t threadIdx, uint32_t& taskIdx)
+	{
+		std::atomic<uint64_t>& range{ m_Ranges[threadIdx].range };
+		uint64_t current{ range.load(std::memory_order_relaxed) };
+
+		while (true)
+		{
+			const uint32_t begin{ static_cast<uint32_t>(current) };
+			const uint32_t end{ static_cast<uint32_t>(current >> 32) };
+
+			if (begin >= end)
+				return false;
+
+			if (range.compare_exchange_weak(current, PackRange(begin + 1, end), std::memory_order_acq_rel, std::memory_order_relaxed))
+			{
+				taskIdx = begin;
+				return true;
+			}
+		}
+	}
+
+	bool ThreadPool::StealTask(uint32_t threadIdx, uint32_t& taskIdx)
+	{
+		//Victims are visited round robin starting next to the thief, so thieves spread over different ranges
+		for (uint32_t offset{ 1 }; offset < m_ThreadCount; ++offset)
+		{
+			std::atomic<uint64_t>& range{ m_Ranges[(threadIdx + offset) % m_ThreadCount].range };
+			uint64_t current{ range.load(std::memory_order_relaxed) };
+
+			while (true)
+			{
+				const uint32_t begin{ static_cast<uint32_t>(current) };
+				const uint32_t end{ static_cast<uint32_t>(current >> 32) };
+
+				if (begin >= end)
+					break;
+
+				if (range.compare_exchange_weak(current, PackRange(begin, end - 1), std::memory_order_acq_rel, std::memory_order_relaxed))
+				{
+					taskIdx = end - 1;
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+}
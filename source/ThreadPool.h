@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dae
+{
+	//Fixed set of std::threads running index based jobs
+	//Every thread (the caller included) starts on its own consecutive range of task indices
+	//and steals from the back of another thread's range once its own runs dry
+	class ThreadPool final
+	{
+	public:
+		explicit ThreadPool(uint32_t threadCount = std::thread::hardware_concurrency());
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool(ThreadPool&&) noexcept = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+		/**
+		 * \brief Runs task(taskIdx, threadIdx) for every taskIdx in [0, taskCount), returns once all of them finished
+		 * \param task threadIdx is in [0, GetThreadCount()), the calling thread being 0
+		 * Not reentrant: task must not call ParallelFor on the same pool
+		 */
+		void ParallelFor(uint32_t taskCount, const std::function<void(uint32_t taskIdx, uint32_t threadIdx)>& task);
+
+		//Worker threads + the calling thread
+		uint32_t GetThreadCount() const { return m_ThreadCount; }
+
+	private:
+		//Remaining task indices of one thread, begin in the low and end in the high 32 bits
+		//Owner pops the front, thieves the back, both through a CAS on the packed range
+		struct alignas(64) TaskRange
+		{
+			std::atomic<uint64_t> range{};
+		};
+
+		uint32_t m_ThreadCount{};
+		std::vector<std::thread> m_Workers{};
+		std::unique_ptr<TaskRange[]> m_Ranges{};
+
+		std::mutex m_Mutex{};
+		std::condition_variable m_StartCondition{};
+		std::condition_variable m_DoneCondition{};
+		const std::function<void(uint32_t, uint32_t)>* m_pTask{};
+		uint64_t m_JobId{}; //Incremented per ParallelFor call, wakes the workers
+		uint32_t m_BusyWorkers{};
+		bool m_IsStopping{};
+
+		void WorkerLoop(uint32_t threadIdx);
+		void RunTasks(uint32_t threadIdx);
+		bool PopTask(uint32_t threadIdx, uint32_t& taskIdx);
+		bool StealTask(uint32_t threadIdx, uint32_t& taskIdx);
+
+		static uint64_t PackRange(uint32_t begin, uint32_t end) { return static_cast<uint64_t>(end) << 32 | begin; }
+	};
+}
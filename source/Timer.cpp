@@ -90,6 +90,13 @@ void Timer::Update()
 
 	m_TotalTime = (float)(((m_CurrentTime - m_PausedTime) - m_BaseTime) * m_SecondsPerCount);
 
+	if (m_FixedTimeStep > 0.0f)
+	{
+		m_FixedTotalTime += m_FixedTimeStep;
+		m_ElapsedTime = m_FixedTimeStep;
+		m_TotalTime = m_FixedTotalTime;
+	}
+
 	//FPS LOGIC
 	m_FPSTimer += m_ElapsedTime;
 	++m_FPSCount;
@@ -18,6 +18,9 @@ namespace dae
 		Timer& operator=(Timer&&) noexcept = delete;
 
 		void StartBenchmark(int numFrames = 10);
+		//Every Update advances the simulated time by timeStep instead of the real elapsed time, 0 goes back to real time
+		//Makes the scene animation independent of how long frames take to render
+		void SetFixedTimeStep(float timeStep) { m_FixedTimeStep = timeStep; m_FixedTotalTime = 0.f; }
 
 		void Reset();
 		void Start();
@@ -46,6 +49,8 @@ namespace dae
 		float m_SecondsPerCount = 0.0f;
 		float m_ElapsedUpperBound = 0.03f;
 		float m_FPSTimer = 0.0f;
+		float m_FixedTimeStep = 0.0f;
+		float m_FixedTotalTime = 0.0f;
 
 		bool m_IsStopped = true;
 		bool m_ForceElapsedUpperBound = false;
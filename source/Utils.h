@@ -1,9 +1,10 @@
 #pragma once
 #include <cassert>
-#include <fstream>
 #include "Math.h"
 #include "DataTypes.h"
+#include "RayStats.h"
 #include <cmath>
+#include <xmmintrin.h>
 
 
 namespace dae
@@ -12,8 +13,11 @@ namespace dae
 	{
 #pragma region Sphere HitTest
 		//SPHERE HIT-TESTS
-		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Distance only, traversal keeps t and the primitive id and SetHitRecord_Sphere fills the surface data of the closest hit
+		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, float& t)
 		{
+			RAY_STATS_ADD(primitiveTests, 1);
+
 
 			//Analytic 
 
@@ -77,52 +81,55 @@ namespace dae
 
 			const float sphereHitDistance{ sqrtf(radiusSqr - originVecPerpendicular) };
 
-			const float t{ originVecDotRayDir - sphereHitDistance };
+			t = originVecDotRayDir - sphereHitDistance;
 
 
 			if (t < ray.min || t > ray.max) return false;
 
+			return true;
+		}
+
+		inline void SetHitRecord_Sphere(const Sphere& sphere, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			hitRecord.t = t;
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = sphere.materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.normal = ((ray.origin - sphere.origin) + (t * ray.direction)) / sphere.radius;
+		}
+
+		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			float t{};
+			if (!HitTest_Sphere(sphere, ray, t)) return false;
+
 			if (!ignoreHitRecord)
-			{
-				hitRecord.t = t;
-				hitRecord.didHit = true;
-				hitRecord.materialIndex = sphere.materialIndex;
-				hitRecord.origin = ray.origin + t * ray.direction;
-				hitRecord.normal = ((ray.origin - sphere.origin) + (t * ray.direction)) / sphere.radius;
-			}
+				SetHitRecord_Sphere(sphere, ray, t, hitRecord);
 
 			return true;
 		}
 
 		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Sphere(sphere, ray, temp, true);
+			float t{};
+			return HitTest_Sphere(sphere, ray, t);
 		}
 #pragma endregion
 #pragma region Plane HitTest
 		//PLANE HIT-TESTS
-		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, float& t)
 		{
+			RAY_STATS_ADD(primitiveTests, 1);
+
 
 			float denominator = Vector3::Dot(ray.direction, plane.normal);
 
 			if (fabs(denominator) > 0.00001f)
 			{
-				float t = Vector3::Dot(plane.origin - ray.origin, plane.normal) / denominator;
+				t = Vector3::Dot(plane.origin - ray.origin, plane.normal) / denominator;
 
 				if (t > ray.min && t < ray.max)
-				{
-					if (!ignoreHitRecord)
-					{
-						hitRecord.t = t;
-						hitRecord.didHit = true;
-						hitRecord.materialIndex = plane.materialIndex;
-						hitRecord.origin = ray.origin + t * ray.direction;
-						hitRecord.normal = plane.normal;
-					}
 					return true;
-				}
 
 				
 			}
@@ -130,17 +137,39 @@ namespace dae
 			return false;
 		}
 
+		inline void SetHitRecord_Plane(const Plane& plane, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			hitRecord.t = t;
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = plane.materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.normal = plane.normal;
+		}
+
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			float t{};
+			if (!HitTest_Plane(plane, ray, t)) return false;
+
+			if (!ignoreHitRecord)
+				SetHitRecord_Plane(plane, ray, t, hitRecord);
+
+			return true;
+		}
+
 		inline bool HitTest_Plane(const Plane& plane, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Plane(plane, ray, temp, true);
+			float t{};
+			return HitTest_Plane(plane, ray, t);
 		}
 #pragma endregion
 #pragma region Triangle HitTest
 		//TRIANGLE HIT-TESTS
 
-		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, float& t)
 		{
+			RAY_STATS_ADD(triangleTests, 1);
+
 
 
 			const float cullDot{ Vector3::Dot(triangle.normal, ray.direction) };
@@ -156,6 +185,8 @@ namespace dae
 				if (cullDot < 0)
 					return false;
 				break;
+			case TriangleCullMode::NoCulling:
+				break;
 			}
 
 			//Mller Trumbore algorithm
@@ -181,32 +212,301 @@ namespace dae
 			if (v < 0.f || (u + v) > 1.f) return false;
 
 
-			float t = invDet * Vector3::Dot(edgeV0V2, qvec);
+			t = invDet * Vector3::Dot(edgeV0V2, qvec);
 			if (t < ray.min || t >= ray.max) return false;
 
+			return true;
+		}
+
+		inline void SetHitRecord_Triangle(const Triangle& triangle, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			hitRecord.t = t;
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = triangle.materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.normal = triangle.normal;
+		}
+
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			float t{};
+			if (!HitTest_Triangle(triangle, ray, t)) return false;
 
 			if (!ignoreHitRecord)
-			{
-				hitRecord.t = t;
-				hitRecord.didHit = true;
-				hitRecord.materialIndex = triangle.materialIndex;
-				hitRecord.origin = ray.origin + t * ray.direction;
-				hitRecord.normal = triangle.normal;
-			}
+				SetHitRecord_Triangle(triangle, ray, t, hitRecord);
 
 			return true;
 		}
 
 		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Triangle(triangle, ray, temp, true);
+			float t{};
+			return HitTest_Triangle(triangle, ray, t);
+		}
+#pragma endregion
+#pragma region BVH Traversal
+
+		//Slab test against an arbitrary box, using a precomputed reciprocal of the ray direction
+		//tEntry receives the distance at which the ray enters the box
+		inline bool SlabTest_AABB(const Vector3& minAABB, const Vector3& maxAABB, const Ray& ray, const Vector3& invDirection, float maxDistance, float& tEntry)
+		{
+			RAY_STATS_ADD(boxTests, 1);
+
+			const float tx1 = (minAABB.x - ray.origin.x) * invDirection.x;
+			const float tx2 = (maxAABB.x - ray.origin.x) * invDirection.x;
+
+			float tmin = std::min(tx1, tx2);
+			float tmax = std::max(tx1, tx2);
+
+			const float ty1 = (minAABB.y - ray.origin.y) * invDirection.y;
+			const float ty2 = (maxAABB.y - ray.origin.y) * invDirection.y;
+
+			tmin = std::max(tmin, std::min(ty1, ty2));
+			tmax = std::min(tmax, std::max(ty1, ty2));
+
+			const float tz1 = (minAABB.z - ray.origin.z) * invDirection.z;
+			const float tz2 = (maxAABB.z - ray.origin.z) * invDirection.z;
+
+			tmin = std::max(tmin, std::min(tz1, tz2));
+			tmax = std::min(tmax, std::max(tz1, tz2));
+
+			tEntry = tmin;
+			return tmax >= tmin && tmax >= ray.min && tmin <= maxDistance;
+		}
+
+		//Slab test against the 4 children of a wide node at once
+		//Returns a bit per child that is hit before maxDistance, tEntry receives the 4 entry distances
+		inline int SlabTest_BVH4(const BVH4Node& node, const __m128 origin[3], const __m128 invDirection[3], float rayMin, float maxDistance, float tEntry[4])
+		{
+			RAY_STATS_ADD(boxTests, 4);
+
+			const __m128 tx1{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), origin[0]), invDirection[0]) };
+			const __m128 tx2{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), origin[0]), invDirection[0]) };
+
+			__m128 tmin{ _mm_min_ps(tx1, tx2) };
+			__m128 tmax{ _mm_max_ps(tx1, tx2) };
+
+			const __m128 ty1{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), origin[1]), invDirection[1]) };
+			const __m128 ty2{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), origin[1]), invDirection[1]) };
+
+			tmin = _mm_max_ps(tmin, _mm_min_ps(ty1, ty2));
+			tmax = _mm_min_ps(tmax, _mm_max_ps(ty1, ty2));
+
+			const __m128 tz1{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), origin[2]), invDirection[2]) };
+			const __m128 tz2{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), origin[2]), invDirection[2]) };
+
+			tmin = _mm_max_ps(tmin, _mm_min_ps(tz1, tz2));
+			tmax = _mm_min_ps(tmax, _mm_max_ps(tz1, tz2));
+
+			const __m128 hit{ _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmpge_ps(tmax, _mm_set1_ps(rayMin))),
+				_mm_cmple_ps(tmin, _mm_set1_ps(maxDistance))) };
+
+			_mm_storeu_ps(tEntry, tmin);
+			return _mm_movemask_ps(hit) & node.childMask;
+		}
+
+		//Traverse_BVH over the collapsed 4-wide nodes, children are visited in the order given by the ray direction signs
+		template<typename IntersectPrimitive>
+		inline bool Traverse_BVH4(const BVH& bvh, const Ray& ray, float& closestT, bool stopOnFirstHit, IntersectPrimitive&& intersectPrimitive)
+		{
+			const std::vector<BVH4Node>& nodes{ bvh.GetWideNodes() };
+
+			const __m128 origin[3]{ _mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y), _mm_set1_ps(ray.origin.z) };
+			const __m128 invDirection[3]{ _mm_set1_ps(1.f / ray.direction.x), _mm_set1_ps(1.f / ray.direction.y), _mm_set1_ps(1.f / ray.direction.z) };
+			const bool negativeDirection[3]{ ray.direction.x < 0.f, ray.direction.y < 0.f, ray.direction.z < 0.f };
+
+			bool didHit{};
+
+			//Children still to visit: wide node index (inner) or primitive range (leaf) + the distance at which the ray enters them
+			constexpr int maxStackSize{ 128 };
+			uint32_t firstStack[maxStackSize];
+			uint32_t countStack[maxStackSize];
+			float entryStack[maxStackSize];
+			int stackSize{};
+
+			firstStack[0] = 0;
+			countStack[0] = 0;
+			entryStack[0] = ray.min;
+			stackSize = 1;
+
+			while (stackSize > 0)
+			{
+				--stackSize;
+				if (entryStack[stackSize] > closestT)
+					continue;
+
+				const uint32_t first{ firstStack[stackSize] };
+				const uint32_t count{ countStack[stackSize] };
+
+				if (count > 0)
+				{
+					for (uint32_t i{}; i < count; ++i)
+					{
+						if (!intersectPrimitive(first + i)) continue;
+
+						if (stopOnFirstHit) return true;
+
+						didHit = true;
+					}
+					continue;
+				}
+
+				const BVH4Node& node{ nodes[first] };
+
+				float tEntry[4];
+				const int hitMask{ SlabTest_BVH4(node, origin, invDirection, ray.min, closestT, tEntry) };
+				if (hitMask == 0)
+					continue;
+
+				//Near pair first, within each pair the near child first
+				const int nearPair{ negativeDirection[node.splitAxis[0]] ? 2 : 0 };
+				const int farPair{ 2 - nearPair };
+				const int order[4]
+				{
+					nearPair + (negativeDirection[node.splitAxis[1 + nearPair / 2]] ? 1 : 0),
+					nearPair + (negativeDirection[node.splitAxis[1 + nearPair / 2]] ? 0 : 1),
+					farPair + (negativeDirection[node.splitAxis[1 + farPair / 2]] ? 1 : 0),
+					farPair + (negativeDirection[node.splitAxis[1 + farPair / 2]] ? 0 : 1)
+				};
+
+				//Pushed far to near, so the nearest child is popped next
+				for (int orderIdx{ 3 }; orderIdx >= 0; --orderIdx)
+				{
+					const int slot{ order[orderIdx] };
+					if ((hitMask & (1 << slot)) == 0) continue;
+
+					assert(stackSize < maxStackSize);
+					firstStack[stackSize] = node.childFirst[slot];
+					countStack[stackSize] = node.childCount[slot];
+					entryStack[stackSize] = tEntry[slot];
+					++stackSize;
+				}
+			}
+
+			return didHit;
+		}
+
+		/**
+		 * \brief Front-to-back traversal of a BVH, shared by the mesh (triangles) and scene (instances) hierarchies
+		 * \param bvh hierarchy to traverse
+		 * \param ray ray in the space the hierarchy was built in
+		 * \param closestT distance of the closest hit so far, nodes further away are skipped
+		 * \param stopOnFirstHit any-hit query, terminate as soon as intersectPrimitive reports a hit
+		 * \param intersectPrimitive bool(uint32_t primitiveSlot), returns true on a hit (closest-hit: only when it lowered closestT)
+		 * primitiveSlot is a position in bvh.GetPrimitiveIndices(), data stored in that order is read contiguously per leaf
+		 * \return true if any primitive reported a hit
+		 */
+		template<typename IntersectPrimitive>
+		inline bool Traverse_BVH(const BVH& bvh, const Ray& ray, float& closestT, bool stopOnFirstHit, IntersectPrimitive&& intersectPrimitive)
+		{
+			const std::vector<BVHNode>& nodes{ bvh.GetNodes() };
+
+			if (nodes.empty())
+				return false;
+
+			if (!bvh.GetWideNodes().empty())
+			{
+				//The root's bounds live in the binary hierarchy only, cull on them before going wide
+				const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+				float tEntry{};
+				if (!SlabTest_AABB(nodes[0].minAABB, nodes[0].maxAABB, ray, invDirection, closestT, tEntry))
+					return false;
+
+				return Traverse_BVH4(bvh, ray, closestT, stopOnFirstHit, intersectPrimitive);
+			}
+
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			float tEntry{};
+			if (!SlabTest_AABB(nodes[0].minAABB, nodes[0].maxAABB, ray, invDirection, closestT, tEntry))
+				return false;
+
+			bool didHit{};
+
+			//Nodes still to visit + the distance at which the ray enters them
+			constexpr int maxStackSize{ 64 };
+			uint32_t nodeStack[maxStackSize];
+			float entryStack[maxStackSize];
+			int stackSize{};
+
+			uint32_t nodeIdx{ 0 };
+
+			while (true)
+			{
+				const BVHNode& node{ nodes[nodeIdx] };
+
+				if (node.IsLeaf())
+				{
+					for (uint32_t i{}; i < node.primitiveCount; ++i)
+					{
+						if (!intersectPrimitive(node.leftFirst + i)) continue;
+
+						if (stopOnFirstHit) return true;
+
+						didHit = true;
+					}
+				}
+				else
+				{
+					uint32_t nearIdx{ node.leftFirst };
+					uint32_t farIdx{ node.leftFirst + 1 };
+
+					float tNear{}, tFar{};
+					const bool hitNear{ SlabTest_AABB(nodes[nearIdx].minAABB, nodes[nearIdx].maxAABB, ray, invDirection, closestT, tNear) };
+					const bool hitFar{ SlabTest_AABB(nodes[farIdx].minAABB, nodes[farIdx].maxAABB, ray, invDirection, closestT, tFar) };
+
+					if (hitNear && hitFar)
+					{
+						//Visit the closest child first, so the far one can get culled by a hit
+						if (tFar < tNear)
+						{
+							std::swap(nearIdx, farIdx);
+							std::swap(tNear, tFar);
+						}
+
+						assert(stackSize < maxStackSize);
+						nodeStack[stackSize] = farIdx;
+						entryStack[stackSize] = tFar;
+						++stackSize;
+
+						nodeIdx = nearIdx;
+						continue;
+					}
+
+					if (hitNear || hitFar)
+					{
+						nodeIdx = hitNear ? nearIdx : farIdx;
+						continue;
+					}
+				}
+
+				//Pop the next node that can still contain a closer hit
+				bool foundNode{};
+				while (stackSize > 0)
+				{
+					--stackSize;
+					if (entryStack[stackSize] <= closestT)
+					{
+						nodeIdx = nodeStack[stackSize];
+						foundNode = true;
+						break;
+					}
+				}
+
+				if (!foundNode)
+					break;
+			}
+
+			return didHit;
 		}
 #pragma endregion
 #pragma region TriangeMesh HitTest
 
 		inline bool SlabTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
 		{
+			RAY_STATS_ADD(boxTests, 1);
+
 
 			float tx1 = (mesh.transformedminAABB.x - ray.origin.x) / ray.direction.x;
 			float tx2 = (mesh.transformedMaxAABB.x - ray.origin.x) / ray.direction.x;
@@ -229,154 +529,552 @@ namespace dae
 			return tmax > 0 && tmax >= tmin;
 		}
 
+		//Transforms a world space ray into the object space of the mesh
+		//The direction is not renormalized, so distances along the ray are the same in both spaces
+		inline Ray TransformRayToObjectSpace(const TriangleMesh& mesh, const Ray& ray)
+		{
+			return Ray{
+				mesh.inverseTransform.TransformPoint(ray.origin),
+				mesh.inverseTransform.TransformVector(ray.direction),
+				ray.min,
+				ray.max
+			};
+		}
 
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Mller Trumbore on the precomputed data of one mesh triangle, same result as HitTest_Triangle
+		//cullSign: 1 culls back faces, -1 front faces, 0 nothing, so there is no cull mode switch per triangle
+		inline bool HitTest_TriangleSoA(const TriangleSoA& triangles, uint32_t triangleIdx, const Ray& ray, float cullSign, float maxDistance, float& t)
 		{
+			RAY_STATS_ADD(triangleTests, 1);
 
+			const float cullDot{ triangles.normalX[triangleIdx] * ray.direction.x + triangles.normalY[triangleIdx] * ray.direction.y
+				+ triangles.normalZ[triangleIdx] * ray.direction.z };
+			if (cullSign * cullDot > 0.f) return false;
 
-			if (mesh.slabTestOn)
-				if (!SlabTest_TriangleMesh(mesh, ray))
-					return false;
+			const float edge1X{ triangles.edge1X[triangleIdx] };
+			const float edge1Y{ triangles.edge1Y[triangleIdx] };
+			const float edge1Z{ triangles.edge1Z[triangleIdx] };
+			const float edge2X{ triangles.edge2X[triangleIdx] };
+			const float edge2Y{ triangles.edge2Y[triangleIdx] };
+			const float edge2Z{ triangles.edge2Z[triangleIdx] };
 
+			//pvec = direction x edge2
+			const float pvecX{ ray.direction.y * edge2Z - ray.direction.z * edge2Y };
+			const float pvecY{ ray.direction.z * edge2X - ray.direction.x * edge2Z };
+			const float pvecZ{ ray.direction.x * edge2Y - ray.direction.y * edge2X };
 
-			HitRecord tempHit{};
-			bool didHit{};
+			const float det{ edge1X * pvecX + edge1Y * pvecY + edge1Z * pvecZ };
+			if (abs(det) < FLT_EPSILON) return false;
+
+			const float invDet{ 1.f / det };
 
-			Triangle tempTriangle{};
+			const float tvecX{ ray.origin.x - triangles.v0X[triangleIdx] };
+			const float tvecY{ ray.origin.y - triangles.v0Y[triangleIdx] };
+			const float tvecZ{ ray.origin.z - triangles.v0Z[triangleIdx] };
 
-			tempTriangle.cullMode = mesh.cullMode;
-			tempTriangle.materialIndex = mesh.materialIndex;
+			const float u{ invDet * (tvecX * pvecX + tvecY * pvecY + tvecZ * pvecZ) };
+			if (u < 0.f || u > 1.f) return false;
 
+			//qvec = tvec x edge1
+			const float qvecX{ tvecY * edge1Z - tvecZ * edge1Y };
+			const float qvecY{ tvecZ * edge1X - tvecX * edge1Z };
+			const float qvecZ{ tvecX * edge1Y - tvecY * edge1X };
 
-			// For each triangle
-			for (size_t triangleIdx{}; triangleIdx < mesh.indices.size(); triangleIdx += 3)
+			const float v{ invDet * (ray.direction.x * qvecX + ray.direction.y * qvecY + ray.direction.z * qvecZ) };
+			if (v < 0.f || (u + v) > 1.f) return false;
+
+			t = invDet * (edge2X * qvecX + edge2Y * qvecY + edge2Z * qvecZ);
+			return t >= ray.min && t < maxDistance;
+		}
+
+		//Fills hitRecord in world space for a hit at distance t on triangleData[triangleIdx], the object space ray has the same t
+		inline void SetHitRecord_TriangleMesh(const TriangleMesh& mesh, uint32_t triangleIdx, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			const TriangleSoA& triangles{ mesh.triangleData };
+
+			hitRecord.t = t;
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = mesh.materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.normal = mesh.normalTransform.TransformVector(
+				Vector3{ triangles.normalX[triangleIdx], triangles.normalY[triangleIdx], triangles.normalZ[triangleIdx] }).Normalized();
+		}
+
+		//Expects an object space ray, only hits closer than t count: lowers t and sets triangleIdx (a triangleData slot, BVH leaf order)
+		//stopOnFirstHit returns on any such hit (shadow rays), t and triangleIdx are then left alone
+		inline bool HitTest_TriangleMeshObjectSpace(const TriangleMesh& mesh, const Ray& objectRay, float& t, uint32_t& triangleIdx, bool stopOnFirstHit = false)
+		{
+			const TriangleSoA& triangles{ mesh.triangleData };
+			float closestT{ std::min(t, objectRay.max) };
+			uint32_t closestTriangleIdx{};
+
+			const float cullSign{ mesh.cullMode == TriangleCullMode::BackFaceCulling ? 1.f
+				: mesh.cullMode == TriangleCullMode::FrontFaceCulling ? -1.f : 0.f };
+
+			//Only the distance and slot of the closest triangle are kept, its surface data is computed once afterwards
+			auto intersectTriangle = [&](uint32_t triangleSlot)
 			{
-	
-				tempTriangle.v0 = mesh.transformedPositions[mesh.indices[triangleIdx]];
-				tempTriangle.v1 = mesh.transformedPositions[mesh.indices[triangleIdx + 1]];
-				tempTriangle.v2 = mesh.transformedPositions[mesh.indices[triangleIdx + 2]];
-				tempTriangle.normal = mesh.transformedNormals[triangleIdx / 3];
+				float triangleT{};
+				if (!HitTest_TriangleSoA(triangles, triangleSlot, objectRay, cullSign, closestT, triangleT)) return false;
 
-				if (!HitTest_Triangle(tempTriangle, ray, tempHit, ignoreHitRecord)) continue;
-	
-				if (ignoreHitRecord) return true;
+				closestT = triangleT;
+				closestTriangleIdx = triangleSlot;
+				return true;
+			};
 
-				if (hitRecord.t > tempHit.t)
+			bool didHit{};
+			if (mesh.bvhOn && !mesh.bvh.IsEmpty())
+			{
+				didHit = Traverse_BVH(mesh.bvh, objectRay, closestT, stopOnFirstHit, intersectTriangle);
+			}
+			else
+			{
+				// For each triangle
+				const uint32_t triangleCount{ static_cast<uint32_t>(triangles.Size()) };
+				for (uint32_t triangleSlot{}; triangleSlot < triangleCount; ++triangleSlot)
 				{
-					hitRecord = tempHit;
+					if (!intersectTriangle(triangleSlot)) continue;
+
+					didHit = true;
+					if (stopOnFirstHit) break;
 				}
+			}
 
-				didHit = true;
+			if (didHit && !stopOnFirstHit)
+			{
+				t = closestT;
+				triangleIdx = closestTriangleIdx;
 			}
 
 			return didHit;
 		}
 
+		//World space ray, same contract as HitTest_TriangleMeshObjectSpace
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, float& t, uint32_t& triangleIdx, bool stopOnFirstHit = false)
+		{
+			if (mesh.slabTestOn)
+				if (!SlabTest_TriangleMesh(mesh, ray))
+					return false;
+
+			return HitTest_TriangleMeshObjectSpace(mesh, TransformRayToObjectSpace(mesh, ray), t, triangleIdx, stopOnFirstHit);
+		}
+
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			float t{ hitRecord.t };
+			uint32_t triangleIdx{};
+			if (!HitTest_TriangleMesh(mesh, ray, t, triangleIdx, ignoreHitRecord)) return false;
+
+			if (!ignoreHitRecord)
+				SetHitRecord_TriangleMesh(mesh, triangleIdx, ray, t, hitRecord);
+
+			return true;
+		}
+
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_TriangleMesh(mesh, ray, temp, true);
+			float t{ FLT_MAX };
+			uint32_t triangleIdx{};
+			return HitTest_TriangleMesh(mesh, ray, t, triangleIdx, true);
 		}
 
 
 #pragma endregion
-	}
+#pragma region Packet HitTests
+		//SSE versions of the tests above for a Ray4, returning a lane mask of the hits
+		//Every operation mirrors the scalar test (same order, same comparisons), so each lane computes the exact same t
 
-	namespace LightUtils
-	{
-		//Direction from target to light
-		inline Vector3 GetDirectionToLight(const Light& light, const Vector3 origin)
+		//Lanes of mask take a, the others keep b
+		inline __m128 Select4(const __m128& mask, const __m128& a, const __m128& b)
 		{
-			return light.origin - origin;
+			return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
 		}
 
-		inline ColorRGB GetRadiance(const Light& light, const Vector3& target)
+		inline __m128 Abs4(const __m128& value)
 		{
-			ColorRGB Ergb = {};
+			return _mm_andnot_ps(_mm_set1_ps(-0.f), value);
+		}
 
-			if (light.type == LightType::Point)
-				Ergb = light.color * (light.intensity / (light.origin - target).SqrMagnitude());
-			else if (light.type == LightType::Directional)
-				Ergb = light.color * light.intensity;
-			
-			return Ergb;
+		//std::min(a, b) / std::max(a, b) including their NaN behaviour (_mm_min_ps/_mm_max_ps return the second operand)
+		inline __m128 StdMin4(const __m128& a, const __m128& b) { return _mm_min_ps(b, a); }
+		inline __m128 StdMax4(const __m128& a, const __m128& b) { return _mm_max_ps(b, a); }
+
+		inline __m128 HitTest_Sphere4(const Sphere& sphere, const Ray4& ray, __m128& t)
+		{
+			RAY_STATS_ADD(primitiveTests, 4);
+
+			const __m128 originVecX{ _mm_sub_ps(_mm_set1_ps(sphere.origin.x), ray.originX) };
+			const __m128 originVecY{ _mm_sub_ps(_mm_set1_ps(sphere.origin.y), ray.originY) };
+			const __m128 originVecZ{ _mm_sub_ps(_mm_set1_ps(sphere.origin.z), ray.originZ) };
+
+			const __m128 originVecSqrMag{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(originVecX, originVecX), _mm_mul_ps(originVecY, originVecY)),
+				_mm_mul_ps(originVecZ, originVecZ)) };
+
+			const __m128 originVecDotRayDir{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(ray.directionX, originVecX), _mm_mul_ps(ray.directionY, originVecY)),
+				_mm_mul_ps(ray.directionZ, originVecZ)) };
+
+			const __m128 originVecPerpendicular{ _mm_sub_ps(originVecSqrMag, _mm_mul_ps(originVecDotRayDir, originVecDotRayDir)) };
+
+			const __m128 radiusSqr{ _mm_set1_ps(Square(sphere.radius)) };
 
+			__m128 hit{ _mm_cmpnlt_ps(radiusSqr, originVecPerpendicular) };
+
+			const __m128 sphereHitDistance{ _mm_sqrt_ps(_mm_sub_ps(radiusSqr, originVecPerpendicular)) };
+
+			t = _mm_sub_ps(originVecDotRayDir, sphereHitDistance);
+
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpnlt_ps(t, ray.min), _mm_cmpngt_ps(t, ray.max)));
+			return hit;
 		}
-	}
 
-	namespace Utils
-	{
-		//Just parses vertices and indices
-#pragma warning(push)
-#pragma warning(disable : 4505) //Warning unreferenced local function
-		static bool ParseOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices)
+		inline __m128 HitTest_Plane4(const Plane& plane, const Ray4& ray, __m128& t)
 		{
-			std::ifstream file(filename);
-			if (!file)
-				return false;
+			RAY_STATS_ADD(primitiveTests, 4);
+
+			const __m128 normalX{ _mm_set1_ps(plane.normal.x) };
+			const __m128 normalY{ _mm_set1_ps(plane.normal.y) };
+			const __m128 normalZ{ _mm_set1_ps(plane.normal.z) };
+
+			const __m128 denominator{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(ray.directionX, normalX), _mm_mul_ps(ray.directionY, normalY)),
+				_mm_mul_ps(ray.directionZ, normalZ)) };
+
+			__m128 hit{ _mm_cmpgt_ps(Abs4(denominator), _mm_set1_ps(0.00001f)) };
+
+			const __m128 toPlaneX{ _mm_sub_ps(_mm_set1_ps(plane.origin.x), ray.originX) };
+			const __m128 toPlaneY{ _mm_sub_ps(_mm_set1_ps(plane.origin.y), ray.originY) };
+			const __m128 toPlaneZ{ _mm_sub_ps(_mm_set1_ps(plane.origin.z), ray.originZ) };
+
+			t = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(toPlaneX, normalX), _mm_mul_ps(toPlaneY, normalY)), _mm_mul_ps(toPlaneZ, normalZ)),
+				denominator);
+
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(t, ray.min), _mm_cmplt_ps(t, ray.max)));
+			return hit;
+		}
+
+		//Shared Mller Trumbore part of the triangle tests, the edges/first vertex are broadcast by the caller
+		inline __m128 HitTest_TriangleEdges4(const Ray4& ray, const __m128& v0X, const __m128& v0Y, const __m128& v0Z,
+			const __m128& edge1X, const __m128& edge1Y, const __m128& edge1Z, const __m128& edge2X, const __m128& edge2Y, const __m128& edge2Z, __m128& t)
+		{
+			const __m128 pvecX{ _mm_sub_ps(_mm_mul_ps(ray.directionY, edge2Z), _mm_mul_ps(ray.directionZ, edge2Y)) };
+			const __m128 pvecY{ _mm_sub_ps(_mm_mul_ps(ray.directionZ, edge2X), _mm_mul_ps(ray.directionX, edge2Z)) };
+			const __m128 pvecZ{ _mm_sub_ps(_mm_mul_ps(ray.directionX, edge2Y), _mm_mul_ps(ray.directionY, edge2X)) };
+
+			const __m128 det{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, pvecX), _mm_mul_ps(edge1Y, pvecY)), _mm_mul_ps(edge1Z, pvecZ)) };
+			__m128 hit{ _mm_cmpnlt_ps(Abs4(det), _mm_set1_ps(FLT_EPSILON)) };
 
-			std::string sCommand;
-			// start a while iteration ending when the end of file is reached (ios::eof)
-			while (!file.eof())
+			const __m128 invDet{ _mm_div_ps(_mm_set1_ps(1.f), det) };
+
+			const __m128 tvecX{ _mm_sub_ps(ray.originX, v0X) };
+			const __m128 tvecY{ _mm_sub_ps(ray.originY, v0Y) };
+			const __m128 tvecZ{ _mm_sub_ps(ray.originZ, v0Z) };
+
+			const __m128 u{ _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tvecX, pvecX), _mm_mul_ps(tvecY, pvecY)), _mm_mul_ps(tvecZ, pvecZ))) };
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpnlt_ps(u, _mm_setzero_ps()), _mm_cmpngt_ps(u, _mm_set1_ps(1.f))));
+
+			const __m128 qvecX{ _mm_sub_ps(_mm_mul_ps(tvecY, edge1Z), _mm_mul_ps(tvecZ, edge1Y)) };
+			const __m128 qvecY{ _mm_sub_ps(_mm_mul_ps(tvecZ, edge1X), _mm_mul_ps(tvecX, edge1Z)) };
+			const __m128 qvecZ{ _mm_sub_ps(_mm_mul_ps(tvecX, edge1Y), _mm_mul_ps(tvecY, edge1X)) };
+
+			const __m128 v{ _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ray.directionX, qvecX), _mm_mul_ps(ray.directionY, qvecY)),
+				_mm_mul_ps(ray.directionZ, qvecZ))) };
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpnlt_ps(v, _mm_setzero_ps()), _mm_cmpngt_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f))));
+
+			t = _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qvecX), _mm_mul_ps(edge2Y, qvecY)), _mm_mul_ps(edge2Z, qvecZ)));
+			return hit;
+		}
+
+		inline __m128 HitTest_Triangle4(const Triangle& triangle, const Ray4& ray, __m128& t)
+		{
+			RAY_STATS_ADD(triangleTests, 4);
+
+			const __m128 cullDot{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.normal.x), ray.directionX),
+				_mm_mul_ps(_mm_set1_ps(triangle.normal.y), ray.directionY)), _mm_mul_ps(_mm_set1_ps(triangle.normal.z), ray.directionZ)) };
+
+			__m128 hit{ _mm_castsi128_ps(_mm_set1_epi32(-1)) };
+			switch (triangle.cullMode)
 			{
-				//read the first word of the string, use the >> operator (istream::operator>>) 
-				file >> sCommand;
-				//use conditional statements to process the different commands	
-				if (sCommand == "#")
-				{
-					// Ignore Comment
-				}
-				else if (sCommand == "v")
+			case TriangleCullMode::BackFaceCulling:
+				hit = _mm_cmpngt_ps(cullDot, _mm_setzero_ps());
+				break;
+			case TriangleCullMode::FrontFaceCulling:
+				hit = _mm_cmpnlt_ps(cullDot, _mm_setzero_ps());
+				break;
+			case TriangleCullMode::NoCulling:
+				break;
+			}
+
+			const Vector3 edgeV0V1 = triangle.v1 - triangle.v0;
+			const Vector3 edgeV0V2 = triangle.v2 - triangle.v0;
+
+			hit = _mm_and_ps(hit, HitTest_TriangleEdges4(ray, _mm_set1_ps(triangle.v0.x), _mm_set1_ps(triangle.v0.y), _mm_set1_ps(triangle.v0.z),
+				_mm_set1_ps(edgeV0V1.x), _mm_set1_ps(edgeV0V1.y), _mm_set1_ps(edgeV0V1.z),
+				_mm_set1_ps(edgeV0V2.x), _mm_set1_ps(edgeV0V2.y), _mm_set1_ps(edgeV0V2.z), t));
+
+			return _mm_and_ps(hit, _mm_and_ps(_mm_cmpnlt_ps(t, ray.min), _mm_cmplt_ps(t, ray.max)));
+		}
+
+		inline __m128 HitTest_TriangleSoA4(const TriangleSoA& triangles, uint32_t triangleIdx, const Ray4& ray, float cullSign, const __m128& maxDistance, __m128& t)
+		{
+			RAY_STATS_ADD(triangleTests, 4);
+
+			const __m128 cullDot{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangles.normalX[triangleIdx]), ray.directionX),
+				_mm_mul_ps(_mm_set1_ps(triangles.normalY[triangleIdx]), ray.directionY)), _mm_mul_ps(_mm_set1_ps(triangles.normalZ[triangleIdx]), ray.directionZ)) };
+
+			__m128 hit{ _mm_cmpngt_ps(_mm_mul_ps(_mm_set1_ps(cullSign), cullDot), _mm_setzero_ps()) };
+
+			hit = _mm_and_ps(hit, HitTest_TriangleEdges4(ray,
+				_mm_set1_ps(triangles.v0X[triangleIdx]), _mm_set1_ps(triangles.v0Y[triangleIdx]), _mm_set1_ps(triangles.v0Z[triangleIdx]),
+				_mm_set1_ps(triangles.edge1X[triangleIdx]), _mm_set1_ps(triangles.edge1Y[triangleIdx]), _mm_set1_ps(triangles.edge1Z[triangleIdx]),
+				_mm_set1_ps(triangles.edge2X[triangleIdx]), _mm_set1_ps(triangles.edge2Y[triangleIdx]), _mm_set1_ps(triangles.edge2Z[triangleIdx]), t));
+
+			return _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, ray.min), _mm_cmplt_ps(t, maxDistance)));
+		}
+
+		inline __m128 SlabTest_AABB4(const Vector3& minAABB, const Vector3& maxAABB, const Ray4& ray, const __m128 invDirection[3], const __m128& maxDistance)
+		{
+			RAY_STATS_ADD(boxTests, 4);
+
+			const __m128 tx1{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minAABB.x), ray.originX), invDirection[0]) };
+			const __m128 tx2{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxAABB.x), ray.originX), invDirection[0]) };
+
+			__m128 tmin{ StdMin4(tx1, tx2) };
+			__m128 tmax{ StdMax4(tx1, tx2) };
+
+			const __m128 ty1{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minAABB.y), ray.originY), invDirection[1]) };
+			const __m128 ty2{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxAABB.y), ray.originY), invDirection[1]) };
+
+			tmin = StdMax4(tmin, StdMin4(ty1, ty2));
+			tmax = StdMin4(tmax, StdMax4(ty1, ty2));
+
+			const __m128 tz1{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minAABB.z), ray.originZ), invDirection[2]) };
+			const __m128 tz2{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxAABB.z), ray.originZ), invDirection[2]) };
+
+			tmin = StdMax4(tmin, StdMin4(tz1, tz2));
+			tmax = StdMin4(tmax, StdMax4(tz1, tz2));
+
+			return _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmpge_ps(tmax, ray.min)), _mm_cmple_ps(tmin, maxDistance));
+		}
+
+		inline __m128 SlabTest_TriangleMesh4(const TriangleMesh& mesh, const Ray4& ray)
+		{
+			RAY_STATS_ADD(boxTests, 4);
+
+			const __m128 tx1{ _mm_div_ps(_mm_sub_ps(_mm_set1_ps(mesh.transformedminAABB.x), ray.originX), ray.directionX) };
+			const __m128 tx2{ _mm_div_ps(_mm_sub_ps(_mm_set1_ps(mesh.transformedMaxAABB.x), ray.originX), ray.directionX) };
+
+			__m128 tmin{ StdMin4(tx1, tx2) };
+			__m128 tmax{ StdMax4(tx1, tx2) };
+
+			const __m128 ty1{ _mm_div_ps(_mm_sub_ps(_mm_set1_ps(mesh.transformedminAABB.y), ray.originY), ray.directionY) };
+			const __m128 ty2{ _mm_div_ps(_mm_sub_ps(_mm_set1_ps(mesh.transformedMaxAABB.y), ray.originY), ray.directionY) };
+
+			tmin = StdMax4(tmin, StdMin4(ty1, ty2));
+			tmax = StdMin4(tmax, StdMax4(ty1, ty2));
+
+			const __m128 tz1{ _mm_div_ps(_mm_sub_ps(_mm_set1_ps(mesh.transformedminAABB.z), ray.originZ), ray.directionZ) };
+			const __m128 tz2{ _mm_div_ps(_mm_sub_ps(_mm_set1_ps(mesh.transformedMaxAABB.z), ray.originZ), ray.directionZ) };
+
+			tmin = StdMax4(tmin, StdMin4(tz1, tz2));
+			tmax = StdMin4(tmax, StdMax4(tz1, tz2));
+
+			return _mm_and_ps(_mm_cmpgt_ps(tmax, _mm_setzero_ps()), _mm_cmpge_ps(tmax, tmin));
+		}
+
+		inline Ray4 TransformRayToObjectSpace4(const TriangleMesh& mesh, const Ray4& ray)
+		{
+			const Vector4 axisX{ mesh.inverseTransform[0] };
+			const Vector4 axisY{ mesh.inverseTransform[1] };
+			const Vector4 axisZ{ mesh.inverseTransform[2] };
+			const Vector4 translation{ mesh.inverseTransform[3] };
+
+			const auto transformVector = [&](const __m128& x, const __m128& y, const __m128& z, float axisXValue, float axisYValue, float axisZValue)
+			{
+				return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(axisXValue), x), _mm_mul_ps(_mm_set1_ps(axisYValue), y)),
+					_mm_mul_ps(_mm_set1_ps(axisZValue), z));
+			};
+
+			Ray4 objectRay{};
+			objectRay.originX = _mm_add_ps(transformVector(ray.originX, ray.originY, ray.originZ, axisX.x, axisY.x, axisZ.x), _mm_set1_ps(translation.x));
+			objectRay.originY = _mm_add_ps(transformVector(ray.originX, ray.originY, ray.originZ, axisX.y, axisY.y, axisZ.y), _mm_set1_ps(translation.y));
+			objectRay.originZ = _mm_add_ps(transformVector(ray.originX, ray.originY, ray.originZ, axisX.z, axisY.z, axisZ.z), _mm_set1_ps(translation.z));
+			objectRay.directionX = transformVector(ray.directionX, ray.directionY, ray.directionZ, axisX.x, axisY.x, axisZ.x);
+			objectRay.directionY = transformVector(ray.directionX, ray.directionY, ray.directionZ, axisX.y, axisY.y, axisZ.y);
+			objectRay.directionZ = transformVector(ray.directionX, ray.directionY, ray.directionZ, axisX.z, axisY.z, axisZ.z);
+			objectRay.min = ray.min;
+			objectRay.max = ray.max;
+			return objectRay;
+		}
+
+		/**
+		 * \brief Traverses a BVH with 4 rays at once, a node is entered when any of the rays hits it
+		 * Every lane stays active only in the nodes its own slab test passed, so it can hit exactly the primitives the scalar traversal reaches
+		 * \param closestT distance of the closest hit per lane, updated by intersectPrimitive
+		 * \param activeLanes lanes that take part, all bits set or clear per lane
+		 * \param intersectPrimitive void(uint32_t primitiveSlot, const __m128& activeLanes), same slot meaning as Traverse_BVH,
+		 * only the lanes in activeLanes may accept a hit
+		 */
+		template<typename IntersectPrimitive>
+		inline void Traverse_BVHPacket(const BVH& bvh, const Ray4& ray, const __m128& closestT, const __m128& activeLanes, IntersectPrimitive&& intersectPrimitive)
+		{
+			const std::vector<BVHNode>& nodes{ bvh.GetNodes() };
+
+			if (nodes.empty())
+				return;
+
+			const __m128 invDirection[3]{ _mm_div_ps(_mm_set1_ps(1.f), ray.directionX), _mm_div_ps(_mm_set1_ps(1.f), ray.directionY),
+				_mm_div_ps(_mm_set1_ps(1.f), ray.directionZ) };
+
+			//Coherent rays: the first one decides which child is visited first
+			const Vector3 orderDirection{ _mm_cvtss_f32(ray.directionX), _mm_cvtss_f32(ray.directionY), _mm_cvtss_f32(ray.directionZ) };
+
+			//Nodes still to visit + the lanes that reached their parent
+			constexpr int maxStackSize{ 64 };
+			uint32_t nodeStack[maxStackSize];
+			__m128 laneStack[maxStackSize];
+			int stackSize{ 1 };
+			nodeStack[0] = 0;
+			laneStack[0] = activeLanes;
+
+			while (stackSize > 0)
+			{
+				--stackSize;
+				const BVHNode& node{ nodes[nodeStack[stackSize]] };
+
+				//Tested when popped, closestT may have dropped since the node was pushed
+				const __m128 nodeLanes{ _mm_and_ps(laneStack[stackSize], SlabTest_AABB4(node.minAABB, node.maxAABB, ray, invDirection, closestT)) };
+				if (_mm_movemask_ps(nodeLanes) == 0)
+					continue;
+
+				if (node.IsLeaf())
 				{
-					//Vertex
-					float x, y, z;
-					file >> x >> y >> z;
-					positions.push_back({ x, y, z });
+					for (uint32_t i{}; i < node.primitiveCount; ++i)
+					{
+						intersectPrimitive(node.leftFirst + i, nodeLanes);
+					}
+					continue;
 				}
-				else if (sCommand == "f")
-				{
-					float i0, i1, i2;
-					file >> i0 >> i1 >> i2;
 
-					indices.push_back((int)i0 - 1);
-					indices.push_back((int)i1 - 1);
-					indices.push_back((int)i2 - 1);
-				}
-				//read till end of line and ignore all remaining chars
-				file.ignore(1000, '\n');
+				const BVHNode& leftChild{ nodes[node.leftFirst] };
+				const BVHNode& rightChild{ nodes[node.leftFirst + 1] };
+				const float centerDistance{ (rightChild.minAABB.x + rightChild.maxAABB.x - leftChild.minAABB.x - leftChild.maxAABB.x) * orderDirection.x
+					+ (rightChild.minAABB.y + rightChild.maxAABB.y - leftChild.minAABB.y - leftChild.maxAABB.y) * orderDirection.y
+					+ (rightChild.minAABB.z + rightChild.maxAABB.z - leftChild.minAABB.z - leftChild.maxAABB.z) * orderDirection.z };
+
+				//Far child first, so the near one is popped next
+				assert(stackSize + 2 <= maxStackSize);
+				const bool leftIsNear{ centerDistance >= 0.f };
+				laneStack[stackSize] = nodeLanes;
+				nodeStack[stackSize++] = leftIsNear ? node.leftFirst + 1 : node.leftFirst;
+				laneStack[stackSize] = nodeLanes;
+				nodeStack[stackSize++] = leftIsNear ? node.leftFirst : node.leftFirst + 1;
+			}
+		}
 
-				if (file.eof()) 
-					break;
+		//Closest hit of the packet on a mesh, lowers t and fills triangleIdx in the lanes that hit closer than t
+		//Only lanes in activeLanes are tested
+		inline __m128 HitTest_TriangleMesh4(const TriangleMesh& mesh, const Ray4& ray, const __m128& activeLanes, __m128& t, uint32_t (&triangleIdx)[4])
+		{
+			__m128 active{ activeLanes };
+			if (mesh.slabTestOn)
+			{
+				active = _mm_and_ps(active, SlabTest_TriangleMesh4(mesh, ray));
+				if (_mm_movemask_ps(active) == 0)
+					return _mm_setzero_ps();
 			}
 
-			//Precompute normals
-			for (uint64_t index = 0; index < indices.size(); index += 3)
+			const Ray4 objectRay{ TransformRayToObjectSpace4(mesh, ray) };
+			const TriangleSoA& triangles{ mesh.triangleData };
+
+			const float cullSign{ mesh.cullMode == TriangleCullMode::BackFaceCulling ? 1.f
+				: mesh.cullMode == TriangleCullMode::FrontFaceCulling ? -1.f : 0.f };
+
+			//Culled lanes get a zero max distance, nothing can be hit before it
+			__m128 closestT{ _mm_and_ps(active, StdMin4(t, objectRay.max)) };
+			__m128 didHit{ _mm_setzero_ps() };
+
+			const auto intersectTriangle = [&](uint32_t triangleSlot, const __m128& triangleLanes)
 			{
-				uint32_t i0 = indices[index];
-				uint32_t i1 = indices[index + 1];
-				uint32_t i2 = indices[index + 2];
+				__m128 triangleT{};
+				const __m128 hit{ _mm_and_ps(triangleLanes, HitTest_TriangleSoA4(triangles, triangleSlot, objectRay, cullSign, closestT, triangleT)) };
+
+				const int hitMask{ _mm_movemask_ps(hit) };
+				if (hitMask == 0)
+					return;
 
-				Vector3 edgeV0V1 = positions[i1] - positions[i0];
-				Vector3 edgeV0V2 = positions[i2] - positions[i0];
-				Vector3 normal = Vector3::Cross(edgeV0V1, edgeV0V2);
+				closestT = Select4(hit, triangleT, closestT);
+				didHit = _mm_or_ps(didHit, hit);
 
-				if(isnan(normal.x))
+				for (int lane{}; lane < 4; ++lane)
 				{
-					int k = 0;
+					if (hitMask & (1 << lane))
+						triangleIdx[lane] = triangleSlot;
 				}
+			};
 
-				normal.Normalize();
-				if (isnan(normal.x))
+			if (mesh.bvhOn && !mesh.bvh.IsEmpty())
+			{
+				Traverse_BVHPacket(mesh.bvh, objectRay, closestT, active, intersectTriangle);
+			}
+			else
+			{
+				const uint32_t triangleCount{ static_cast<uint32_t>(triangles.Size()) };
+				for (uint32_t triangleSlot{}; triangleSlot < triangleCount; ++triangleSlot)
 				{
-					int k = 0;
+					intersectTriangle(triangleSlot, active);
 				}
+			}
 
-				normals.push_back(normal);
+			t = Select4(didHit, closestT, t);
+			return didHit;
+		}
+#pragma endregion
+	}
+
+	namespace LightUtils
+	{
+		//Direction from target to light
+		inline Vector3 GetDirectionToLight(const Light& light, const Vector3 origin)
+		{
+			return light.origin - origin;
+		}
+
+		/**
+		 * \brief Distance past which a light is skipped: its own range, shortened to where its brightest channel's irradiance drops below
+		 * cutoffIrradiance when that's above 0. FLT_MAX when neither limits it (directional lights always)
+		 */
+		inline float GetRange(const Light& light, float cutoffIrradiance)
+		{
+			if (light.type != LightType::Point)
+				return FLT_MAX;
+
+			float range = light.range > 0.f ? light.range : FLT_MAX;
+			if (cutoffIrradiance > 0.f)
+			{
+				const float maxChannel = std::max(light.color.r, std::max(light.color.g, light.color.b));
+				range = std::min(range, sqrtf(light.intensity * maxChannel / cutoffIrradiance));
 			}
 
-			return true;
+			return range;
+		}
+
+		inline ColorRGB GetRadiance(const Light& light, const Vector3& target)
+		{
+			ColorRGB Ergb = {};
+
+			if (light.type == LightType::Point)
+			{
+				const float distanceSqr = (light.origin - target).SqrMagnitude();
+				if (light.range > 0.f && distanceSqr >= light.range * light.range)
+					return Ergb;
+
+				Ergb = light.color * (light.intensity / distanceSqr);
+			}
+			else if (light.type == LightType::Directional)
+				Ergb = light.color * light.intensity;
+			
+			return Ergb;
+
 		}
-#pragma warning(pop)
 	}
 }
 
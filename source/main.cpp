@@ -5,62 +5,235 @@
 #undef main
 
 //Standard includes
+#include <cstring>
 #include <iostream>
+#include <string>
 
 //Project includes
 #include "Timer.h"
 #include "Renderer.h"
 #include "Scene.h"
+#include "Benchmark.h"
+#include "Profiler.h"
 
 using namespace dae;
 
+//Empty/zero values fall back to a default that depends on the mode
+struct LaunchSettings
+{
+	bool headless{ false };
+	bool benchmark{ false };
+	std::string sceneName{}; //Reference scene, benchmark: every built-in scene
+	int width{ 640 };
+	int height{ 480 };
+	int frameCount{}; //Headless: 1, benchmark: BenchmarkSettings::frameCount
+	std::string outputPath{}; //Headless: RayTracing_Buffer.bmp, benchmark: BenchmarkSettings::outputPath (.json/.csv)
+	std::string profilePath{}; //Headless: captures every frame into this Chrome trace when set
+	ProfileLevel profileLevel{ ProfileLevel::Coarse };
+	bool progressive{ true }; //Headless/window: static frames accumulate jittered samples, the benchmark never does
+	uint32_t lightSampleCount{}; //0: every light is shaded, see Renderer::SetLightSampleCount
+	float lightCutoff{}; //0: only the lights' own ranges limit them, see Renderer::SetLightCutoff
+	float refitThreshold{ -1.f }; //Negative: the BVH default, see Scene::SetBVHRefitThreshold
+};
+
+//Light sample counts the L key cycles through
+constexpr uint32_t lightSampleCounts[]{ 0, 1, 4, 16 };
+//Light cutoff irradiances the C key cycles through
+constexpr float lightCutoffs[]{ 0.f, .001f, .01f, .05f };
+//BVH refit thresholds Shift+F5 cycles through
+constexpr float refitThresholds[]{ .05f, .1f, .25f, 1.f };
+
+//Interactive captures: F10 records profileCoarseFrames frames, F11 a single frame with per pixel zones
+constexpr int profileCoarseFrames = 5;
+constexpr const char* profileOutputPath = "profile.json";
+
 void ShutDown(SDL_Window* pWindow)
 {
 	SDL_DestroyWindow(pWindow);
 	SDL_Quit();
 }
 
+void PrintUsage()
+{
+	std::cout << "Usage: RayTracer [--headless | --benchmark] [--scene w1|w2|w3|test|reference|bunny|deform|<file>.scene] [--width 640] [--height 480]"
+		<< " [--frames N] [--output path] [--profile trace.json] [--profile-detailed] [--no-progressive] [--light-samples N] [--light-cutoff E]"
+		<< " [--refit-threshold X]" << std::endl;
+}
+
+bool ParseArguments(int argc, char* args[], LaunchSettings& settings)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const bool hasValue = i + 1 < argc;
+
+		if (strcmp(args[i], "--headless") == 0)
+			settings.headless = true;
+		else if (strcmp(args[i], "--benchmark") == 0)
+			settings.benchmark = true;
+		else if (strcmp(args[i], "--scene") == 0 && hasValue)
+			settings.sceneName = args[++i];
+		else if (strcmp(args[i], "--width") == 0 && hasValue)
+			settings.width = std::atoi(args[++i]);
+		else if (strcmp(args[i], "--height") == 0 && hasValue)
+			settings.height = std::atoi(args[++i]);
+		else if (strcmp(args[i], "--frames") == 0 && hasValue)
+			settings.frameCount = std::atoi(args[++i]);
+		else if (strcmp(args[i], "--output") == 0 && hasValue)
+			settings.outputPath = args[++i];
+		else if (strcmp(args[i], "--profile") == 0 && hasValue)
+			settings.profilePath = args[++i];
+		else if (strcmp(args[i], "--profile-detailed") == 0)
+			settings.profileLevel = ProfileLevel::Detailed;
+		else if (strcmp(args[i], "--no-progressive") == 0)
+			settings.progressive = false;
+		else if (strcmp(args[i], "--light-samples") == 0 && hasValue)
+			settings.lightSampleCount = static_cast<uint32_t>(std::max(std::atoi(args[++i]), 0));
+		else if (strcmp(args[i], "--light-cutoff") == 0 && hasValue)
+			settings.lightCutoff = std::max(static_cast<float>(std::atof(args[++i])), 0.f);
+		else if (strcmp(args[i], "--refit-threshold") == 0 && hasValue)
+			settings.refitThreshold = std::max(static_cast<float>(std::atof(args[++i])), 0.f);
+		else
+			return false;
+	}
+
+	return settings.width > 0 && settings.height > 0 && settings.frameCount >= 0 && !(settings.headless && settings.benchmark);
+}
+
+//Renders frameCount frames into the renderer's own framebuffer and saves the last one, no window or video subsystem involved
+int RunHeadless(const LaunchSettings& settings, Scene* pScene)
+{
+	const int frameCount = std::max(settings.frameCount, 1);
+	const std::string outputPath = settings.outputPath.empty() ? "RayTracing_Buffer.bmp" : settings.outputPath;
+
+	Timer timer{};
+	Renderer renderer{ settings.width, settings.height };
+	renderer.SetProgressiveEnabled(settings.progressive);
+	renderer.SetLightSampleCount(settings.lightSampleCount);
+	renderer.SetLightCutoff(settings.lightCutoff);
+
+	if (!settings.profilePath.empty())
+		Profiler::Get().StartCapture(settings.profileLevel);
+
+	timer.Start();
+	const uint64_t startCounter = SDL_GetPerformanceCounter();
+
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		PROFILE_ZONE("Frame");
+		{
+			PROFILE_ZONE("Scene::Update");
+			pScene->Update(&timer);
+		}
+		renderer.Render(pScene);
+		timer.Update();
+	}
+
+	const float totalSeconds = static_cast<float>(SDL_GetPerformanceCounter() - startCounter) / SDL_GetPerformanceFrequency();
+	timer.Stop();
+
+	if (!settings.profilePath.empty())
+	{
+		Profiler::Get().StopCapture();
+		if (Profiler::Get().WriteChromeTrace(settings.profilePath))
+			std::cout << "Profile written to " << settings.profilePath << std::endl;
+		else
+			std::cout << "Could not write " << settings.profilePath << std::endl;
+	}
+
+	std::cout << "Rendered " << frameCount << " frame(s) of " << settings.width << "x" << settings.height
+		<< " in " << totalSeconds << " s (" << totalSeconds * 1000.f / frameCount << " ms/frame)"
+		<< ", " << std::max(renderer.GetSampleCount(), 1u) << " sample(s) per pixel" << std::endl;
+	pScene->PrintBVHStats();
+	renderer.PrintTileStats();
+	renderer.PrintRayStats();
+
+	if (!renderer.SaveBufferToImage(outputPath))
+	{
+		std::cout << "Could not save " << outputPath << ": " << SDL_GetError() << std::endl;
+		return 1;
+	}
+
+	std::cout << "Saved " << outputPath << std::endl;
+	return 0;
+}
+
 int main(int argc, char* args[])
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
+	LaunchSettings settings{};
+	if (!ParseArguments(argc, args, settings))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	if (settings.benchmark)
+	{
+		BenchmarkSettings benchmarkSettings{};
+		benchmarkSettings.width = settings.width;
+		benchmarkSettings.height = settings.height;
+		if (settings.frameCount > 0)
+			benchmarkSettings.frameCount = settings.frameCount;
+		if (!settings.sceneName.empty())
+			benchmarkSettings.sceneNames.push_back(settings.sceneName);
+		if (!settings.outputPath.empty())
+			benchmarkSettings.outputPath = settings.outputPath;
+		benchmarkSettings.lightSampleCount = settings.lightSampleCount;
+		benchmarkSettings.lightCutoff = settings.lightCutoff;
+		benchmarkSettings.refitThreshold = settings.refitThreshold;
+
+		return RunBenchmark(benchmarkSettings);
+	}
+
+	if (settings.sceneName.empty())
+		settings.sceneName = "reference";
+
+	const auto pScene = CreateScene(settings.sceneName);
+	if (!pScene)
+	{
+		std::cout << "Unknown scene: " << settings.sceneName << std::endl;
+		PrintUsage();
+		return 1;
+	}
+
+	if (settings.refitThreshold >= 0.f)
+		pScene->SetBVHRefitThreshold(settings.refitThreshold);
+	pScene->Initialize();
+
+	if (settings.headless)
+	{
+		const int result = RunHeadless(settings, pScene);
+		delete pScene;
+		return result;
+	}
 
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
 
-	const uint32_t width = 640;
-	const uint32_t height = 480;
-
 	SDL_Window* pWindow = SDL_CreateWindow(
 		"RayTracer - ** Joaquin Verhelst (2DAE15) **",
 		SDL_WINDOWPOS_UNDEFINED,
 		SDL_WINDOWPOS_UNDEFINED,
-		width, height, 0);
+		settings.width, settings.height, 0);
 
 	if (!pWindow)
+	{
+		delete pScene;
 		return 1;
+	}
 
 	//Initialize "framework"
 	const auto pTimer = new Timer();
 	const auto pRenderer = new Renderer(pWindow);
-
-	//const auto pScene = new Scene_W1();
-	//const auto pScene = new Scene_W2();
-	//const auto pScene = new Scene_W3();
-	//const auto pScene = new Scene_W4_TestScene();
-
-	const auto pScene = new Scene_W4_ReferenceScene();
-
-	//const auto pScene = new Scene_W4_BunnyScene();
-
-	pScene->Initialize();
+	pRenderer->SetProgressiveEnabled(settings.progressive);
+	pRenderer->SetLightSampleCount(settings.lightSampleCount);
+	pRenderer->SetLightCutoff(settings.lightCutoff);
 
 	//Start loop
 	pTimer->Start();
 	float printTimer = 0.f;
 	bool isLooping = true;
 	bool takeScreenshot = false;
+	int profileFramesLeft = 0;
 	while (isLooping)
 	{
 		//--------- Get input events ---------
@@ -79,19 +252,110 @@ int main(int argc, char* args[])
 					pRenderer->ToggleShadows();
 				if (e.key.keysym.scancode == SDL_SCANCODE_F3)
 					pRenderer->CycleLightingMode();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F4)
+				{
+					pScene->ToggleBVH();
+					std::cout << "BVH " << (pScene->IsBVHEnabled() ? "ON" : "OFF") << std::endl;
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_F5 && (e.key.keysym.mod & KMOD_SHIFT))
+				{
+					const auto it = std::find(std::begin(refitThresholds), std::end(refitThresholds), pScene->GetBVHRefitThreshold());
+					const bool isLast = it == std::end(refitThresholds) || it + 1 == std::end(refitThresholds);
+					pScene->SetBVHRefitThreshold(isLast ? refitThresholds[0] : *(it + 1));
+					std::cout << "BVH refit threshold: " << pScene->GetBVHRefitThreshold() << " overlap increase before a rebuild" << std::endl;
+				}
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F5)
+				{
+					pScene->ToggleBVHRefit();
+					std::cout << "BVH refit " << (pScene->IsBVHRefitEnabled() ? "ON" : "OFF") << std::endl;
+				}
 				if (e.key.keysym.scancode == SDL_SCANCODE_F6)
 					pTimer->StartBenchmark();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F7)
+				{
+					pScene->CycleMeshBVHBuilder();
+					std::cout << "Mesh BVH builder: " << pScene->GetMeshBVHBuilderName() << std::endl;
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_F8)
+				{
+					pScene->ToggleWideBVH();
+					std::cout << "Wide BVH " << (pScene->IsWideBVHEnabled() ? "ON" : "OFF") << std::endl;
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_F9)
+				{
+					pRenderer->TogglePacketTracing();
+					std::cout << "Packet tracing " << (pRenderer->IsPacketTracingEnabled() ? "ON" : "OFF") << std::endl;
+				}
+				if ((e.key.keysym.scancode == SDL_SCANCODE_F10 || e.key.keysym.scancode == SDL_SCANCODE_F11) && profileFramesLeft == 0)
+				{
+					const bool isDetailed = e.key.keysym.scancode == SDL_SCANCODE_F11;
+					Profiler::Get().StartCapture(isDetailed ? ProfileLevel::Detailed : ProfileLevel::Coarse);
+					profileFramesLeft = isDetailed ? 1 : profileCoarseFrames;
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_T)
+				{
+					pRenderer->CycleToneMapping();
+					std::cout << "Tone mapping: " << pRenderer->GetToneMappingName() << std::endl;
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_P)
+				{
+					pRenderer->SetProgressiveEnabled(!pRenderer->IsProgressiveEnabled());
+					std::cout << "Progressive accumulation " << (pRenderer->IsProgressiveEnabled() ? "ON" : "OFF") << std::endl;
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_L)
+				{
+					const auto it = std::find(std::begin(lightSampleCounts), std::end(lightSampleCounts), pRenderer->GetLightSampleCount());
+					const bool isLast = it == std::end(lightSampleCounts) || it + 1 == std::end(lightSampleCounts);
+					pRenderer->SetLightSampleCount(isLast ? lightSampleCounts[0] : *(it + 1));
+
+					if (pRenderer->GetLightSampleCount() == 0)
+						std::cout << "Light sampling OFF, every light is shaded" << std::endl;
+					else
+						std::cout << "Light sampling: " << pRenderer->GetLightSampleCount() << " light(s) per shading point" << std::endl;
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_C)
+				{
+					const auto it = std::find(std::begin(lightCutoffs), std::end(lightCutoffs), pRenderer->GetLightCutoff());
+					const bool isLast = it == std::end(lightCutoffs) || it + 1 == std::end(lightCutoffs);
+					pRenderer->SetLightCutoff(isLast ? lightCutoffs[0] : *(it + 1));
+
+					if (pRenderer->GetLightCutoff() == 0.f)
+						std::cout << "Light cutoff OFF, only light ranges limit them" << std::endl;
+					else
+						std::cout << "Light cutoff: irradiance " << pRenderer->GetLightCutoff() << std::endl;
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_G)
+				{
+					pRenderer->ToggleGamma();
+					std::cout << "Gamma " << (pRenderer->IsGammaEnabled() ? "ON" : "OFF") << std::endl;
+				}
 				break;
 				
 
 			}
 		}
 
-		//--------- Update ---------
-		pScene->Update(pTimer);
+		{
+			PROFILE_ZONE("Frame");
 
-		//--------- Render ---------
-		pRenderer->Render(pScene);
+			//--------- Update ---------
+			{
+				PROFILE_ZONE("Scene::Update");
+				pScene->Update(pTimer);
+			}
+
+			//--------- Render ---------
+			pRenderer->Render(pScene);
+		}
+
+		if (profileFramesLeft > 0 && --profileFramesLeft == 0)
+		{
+			Profiler::Get().StopCapture();
+			if (Profiler::Get().WriteChromeTrace(profileOutputPath))
+				std::cout << "Profile written to " << profileOutputPath << std::endl;
+			else
+				std::cout << "Could not write " << profileOutputPath << std::endl;
+		}
 
 		//--------- Timer ---------
 		pTimer->Update();
@@ -100,12 +364,17 @@ int main(int argc, char* args[])
 		{
 			printTimer = 0.f;
 			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
+			pScene->PrintBVHStats();
+			pRenderer->PrintTileStats();
+			pRenderer->PrintRayStats();
+			if (pRenderer->IsProgressiveEnabled())
+				std::cout << "Samples per pixel: " << pRenderer->GetSampleCount() << std::endl;
 		}
 
 		//Save screenshot after full render
 		if (takeScreenshot)
 		{
-			if (!pRenderer->SaveBufferToImage())
+			if (pRenderer->SaveBufferToImage())
 				std::cout << "Screenshot saved!" << std::endl;
 			else
 				std::cout << "Something went wrong. Screenshot not saved!" << std::endl;